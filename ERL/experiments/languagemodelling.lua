@@ -33,13 +33,22 @@ function open(filename)
 end
 
 
+-- Read once per VM, the returned function runs every evaluation
+corpus = open(corpusFileName)
+--corpus = string.lower(corpus)
+
+return function()
+
 -- Generate the field
 
 --generatePhenotype(fieldWidth, fieldHeight, connectionRadius, numInputs, numOutputs, inputRange, outputRange)
 local handle = generatePhenotype(fieldWidth, fieldHeight, connectionRadius, 27, 27, 1, 1) --input and output range should be 1?
 
-corpus = open(corpusFileName)
---corpus = string.lower(corpus)
+-- Outputs are read and inputs written in one call per step, indexed from 1
+local outputs = {}
+local inputs = {}
+for n = 1, 27 do inputs[n] = 0 end
+
 fitness = 0
 stepPhenotype(handle, 0, 1)
 str = ""
@@ -51,26 +60,28 @@ for i = 1, trainingIterations+testIterations do
 		else value = 0 end
 
 	--if value > 26 or value < 0 then error("Value incorrect.") end
+	getPhenotypeOutputs(handle, outputs)
 	local total = 0
 	local bestProb = 0
 	local best = 0
 	for n = 0, 26 do
-		local prob = math.max(-1, getPhenotypeOutput(handle, n)) + 1
+		local prob = math.max(-1, outputs[n + 1]) + 1
 		if prob > bestProb then bestProb = prob best = n end
 		total = total + prob
 	end
 	if i > trainingIterations+testIterations-stringLength then str = str..string.char(best+96) end
-	local reward = (math.max(-1, getPhenotypeOutput(handle, value))+1)/total
+	local reward = (math.max(-1, outputs[value + 1])+1)/total
 	--if not (reward < 1) or not (reward > 0) then error("reward out of range "..reward.." "..total.." value: "..value.." "..i.." "..getPhenotypeOutput(handle, value)) end
 	if i > trainingIterations then
 		fitness = fitness + math.log(reward)
 	end
 
-	for n = 0, 26 do
-		setPhenotypeInput(handle, n, 0)
-	end
-	setPhenotypeInput(handle, value, 1)
+	inputs[value + 1] = 1
+	setPhenotypeInputs(handle, inputs)
+	inputs[value + 1] = 0
 	stepPhenotype(handle, reward, stepSize)
 end
 print(str)
 setFitness(fitness)
+
+end
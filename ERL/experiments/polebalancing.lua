@@ -9,6 +9,7 @@
 -- Generate the field
 
 local handle = generatePhenotype(32, 32, 3, 4, 1, 1, 1)
+local inputs = {}
 
 local pixelsPerMeter = 128.0
 local poleLength = 1.0
@@ -55,10 +56,11 @@ for i = 1, 900, 1 do
 
 	local err = dFitness * 10.0
 
-	setPhenotypeInput(handle, 0, cartX * 0.25)
-	setPhenotypeInput(handle, 1, cartVelX)
-	setPhenotypeInput(handle, 2, math.fmod(poleAngle + math.pi, 2.0 * math.pi))
-	setPhenotypeInput(handle, 3, poleAngleVel)
+	inputs[1] = cartX * 0.25
+	inputs[2] = cartVelX
+	inputs[3] = math.fmod(poleAngle + math.pi, 2.0 * math.pi)
+	inputs[4] = poleAngleVel
+	setPhenotypeInputs(handle, inputs)
 
 	stepPhenotype(handle, err, 8)
 
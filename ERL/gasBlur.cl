@@ -54,4 +54,49 @@ void kernel blurY(global const float* source, global float* destination, int wid
 		sum += getSampleWrapY(source, pixelPos + (int3)(0, dy, 0), width, height, numNodes) * importances[dy + 4];
  
 	destination[pixelPos.x + pixelPos.y * width + pixelPos.z * numNodes] = sum;
+}
+
+// Runs all blur passes of one gas plane in one work-group. The X passes and all but the last Y pass are each combined into one wrapped kernel (weights),
+// and the plane stays in local memory between axes. Leaves the same data in both buffers as the blurX/blurY pass loop
+void kernel diffuse(global float* gas, global float* intermediate, int width, int height, int numNodes,
+	constant float* weights, int tapsX, int startX, int tapsY, int startY, local float* planeX, local float* planeY)
+{
+	int x = get_local_id(0);
+	int y = get_local_id(1);
+	int planeStart = get_global_id(2) * numNodes;
+
+	int index = x + y * width;
+
+	// All X passes
+	float sum = 0.0f;
+
+	for (int i = 0; i < tapsX; i++)
+		sum += gas[planeStart + (x + startX + i) % width + y * width] * weights[i];
+
+	planeX[index] = sum;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// All but the last Y pass
+	sum = 0.0f;
+
+	for (int i = 0; i < tapsY; i++)
+		sum += planeX[x + ((y + startY + i) % height) * width] * weights[tapsX + i];
+
+	planeY[index] = sum;
+	intermediate[planeStart + index] = sum;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Last Y pass
+	sum = 0.0f;
+
+	for (int dy = -4; dy <= 4; dy++) {
+		int sampleY = (y + dy) % height;
+		sampleY = sampleY < 0 ? sampleY + height : sampleY;
+
+		sum += planeY[x + sampleY * width] * importances[dy + 4];
+	}
+
+	gas[planeStart + index] = sum;
 }
\ No newline at end of file
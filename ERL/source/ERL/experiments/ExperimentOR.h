@@ -23,18 +23,17 @@
 
 #pragma once
 
-#include <erl/simulation/Experiment.h>
+#include <erl/experiments/ExperimentTruthTable.h>
+
+class ExperimentOR : public ExperimentTruthTable {
+protected:
+	// Inherited from ExperimentTruthTable
+	float getRowPenalty(float target, float output) const;
 
-class ExperimentOR : public erl::Experiment {
 public:
-	// Inherited from Experiment
-	float evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
-		const std::shared_ptr<cl::Image2D> &randomImage,
-		const std::shared_ptr<cl::Program> &blurProgram,
-		const std::shared_ptr<cl::Kernel> &blurKernelX,
-		const std::shared_ptr<cl::Kernel> &blurKernelY,
-		const std::vector<std::function<float(float)>> &activationFunctions,
-		const std::vector<std::string> &activationFunctionNames,
-		float minInitRec, float maxInitRec, erl::Logger &logger,
-		erl::ComputeSystem &cs, std::mt19937 &generator);
+	ExperimentOR();
+
+	std::shared_ptr<erl::Experiment> clone() const {
+		return std::make_shared<ExperimentOR>(*this);
+	}
 };
\ No newline at end of file
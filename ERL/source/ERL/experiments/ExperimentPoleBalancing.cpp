@@ -27,6 +27,16 @@
 
 #include <iostream>
 
+namespace {
+	const erl::FieldDimensions fieldDimensions = { 16, 16, 3, 4, 1, 1, 1 };
+
+	const int numSteps = 1200;
+	const int substeps = 8;
+
+	// Substeps of the whole run, to choose between interpreted and specialized rules
+	const int expectedSteps = numSteps * substeps;
+}
+
 float ExperimentPoleBalancing::evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
 	const std::shared_ptr<cl::Image2D> &randomImage,
 	const std::shared_ptr<cl::Program> &blurProgram,
@@ -39,7 +49,11 @@ float ExperimentPoleBalancing::evaluate(erl::Field2DGenes &fieldGenes, const erl
 {
 	erl::Field2DCL field;
 
-	field.create(fieldGenes, cs, 16, 16, 3, 4, 1, 1, 1, randomImage, blurProgram, blurKernelX, blurKernelY, activationFunctions, activationFunctionNames, minInitRec, maxInitRec, generator, logger);
+	field._halfPrecisionRecurrents = _halfPrecisionRecurrents;
+
+	field._expectedSteps = expectedSteps;
+
+	field.create(fieldGenes, cs, fieldDimensions._width, fieldDimensions._height, fieldDimensions._connectionRadius, fieldDimensions._numInputs, fieldDimensions._numOutputs, fieldDimensions._inputRange, fieldDimensions._outputRange, randomImage, blurProgram, blurKernelX, blurKernelY, activationFunctions, activationFunctionNames, minInitRec, maxInitRec, generator, logger);
 
 	std::uniform_real_distribution<float> initPosDist(-1.0f, 1.0f);
 	std::uniform_real_distribution<float> initPoleVelDist(-0.05f, 0.05f);
@@ -69,7 +83,7 @@ float ExperimentPoleBalancing::evaluate(erl::Field2DGenes &fieldGenes, const erl
 
 	float totalFitness = 0.0f;
 
-	for (size_t i = 0; i < 1200; i++) {
+	for (int i = 0; i < numSteps; i++) {
 		//std::cout << "Step " << i << std::endl;
 
 		// Update fitness
@@ -97,7 +111,7 @@ float ExperimentPoleBalancing::evaluate(erl::Field2DGenes &fieldGenes, const erl
 		field.setInput(2, std::fmodf(poleAngle + static_cast<float>(std::_Pi), 2.0f * static_cast<float>(std::_Pi)));
 		field.setInput(3, poleAngleVel);
 
-		field.update(error, cs, activationFunctions, 8, generator);
+		field.update(error, cs, activationFunctions, substeps, generator);
 
 		float dir = std::min<float>(1.0f, std::max<float>(-1.0f, field.getOutput(0)));
 
@@ -154,4 +168,29 @@ float ExperimentPoleBalancing::evaluate(erl::Field2DGenes &fieldGenes, const erl
 	std::cout << "Pole balancing experiment finished with fitness of " << totalFitness << "." << std::endl;
 
 	return totalFitness;
+}
+
+void ExperimentPoleBalancing::addNodeUpdateSources(size_t, erl::Field2DGenes &fieldGenes, const std::vector<std::string> &activationFunctionNames, erl::Logger &logger,
+	erl::ComputeSystem &cs, std::vector<std::string> &sources)
+{
+	erl::Field2DCL field;
+
+	field._halfPrecisionRecurrents = _halfPrecisionRecurrents;
+
+	field._expectedSteps = expectedSteps;
+
+	sources.push_back(field.getNodeUpdateSource(fieldGenes, cs, fieldDimensions._width, fieldDimensions._height, fieldDimensions._connectionRadius, fieldDimensions._numInputs, fieldDimensions._numOutputs, fieldDimensions._outputRange, activationFunctionNames, logger));
+}
+
+erl::PrecisionDivergence ExperimentPoleBalancing::compareRecurrentPrecision(erl::Field2DGenes &fieldGenes,
+	const std::shared_ptr<cl::Image2D> &randomImage,
+	const std::shared_ptr<cl::Program> &blurProgram,
+	const std::shared_ptr<cl::Kernel> &blurKernelX,
+	const std::shared_ptr<cl::Kernel> &blurKernelY,
+	const std::vector<std::function<float(float)>> &activationFunctions,
+	const std::vector<std::string> &activationFunctionNames,
+	float minInitRec, float maxInitRec, erl::Logger &logger,
+	erl::ComputeSystem &cs, std::mt19937 &generator) const
+{
+	return erl::compareRecurrentPrecision(fieldGenes, cs, fieldDimensions._width, fieldDimensions._height, fieldDimensions._connectionRadius, fieldDimensions._numInputs, fieldDimensions._numOutputs, fieldDimensions._inputRange, fieldDimensions._outputRange, randomImage, blurProgram, blurKernelX, blurKernelY, activationFunctions, activationFunctionNames, minInitRec, maxInitRec, numSteps, substeps, generator, logger);
 }
\ No newline at end of file
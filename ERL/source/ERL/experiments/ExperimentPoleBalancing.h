@@ -24,6 +24,7 @@
 #pragma once
 
 #include <erl/simulation/Experiment.h>
+#include <erl/simulation/PrecisionComparison.h>
 
 class ExperimentPoleBalancing : public erl::Experiment {
 public:
@@ -37,4 +38,22 @@ public:
 		const std::vector<std::string> &activationFunctionNames,
 		float minInitRec, float maxInitRec, erl::Logger &logger,
 		erl::ComputeSystem &cs, std::mt19937 &generator);
+
+	void addNodeUpdateSources(size_t numRuns, erl::Field2DGenes &fieldGenes, const std::vector<std::string> &activationFunctionNames, erl::Logger &logger,
+		erl::ComputeSystem &cs, std::vector<std::string> &sources);
+
+	// Runs compareRecurrentPrecision on this experiment's field for as many steps as an evaluation
+	erl::PrecisionDivergence compareRecurrentPrecision(erl::Field2DGenes &fieldGenes,
+		const std::shared_ptr<cl::Image2D> &randomImage,
+		const std::shared_ptr<cl::Program> &blurProgram,
+		const std::shared_ptr<cl::Kernel> &blurKernelX,
+		const std::shared_ptr<cl::Kernel> &blurKernelY,
+		const std::vector<std::function<float(float)>> &activationFunctions,
+		const std::vector<std::string> &activationFunctionNames,
+		float minInitRec, float maxInitRec, erl::Logger &logger,
+		erl::ComputeSystem &cs, std::mt19937 &generator) const;
+
+	std::shared_ptr<erl::Experiment> clone() const {
+		return std::make_shared<ExperimentPoleBalancing>(*this);
+	}
 };
\ No newline at end of file
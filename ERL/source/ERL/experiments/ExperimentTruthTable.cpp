@@ -0,0 +1,105 @@
+#include <erl/experiments/ExperimentTruthTable.h>
+#include <erl/field/Field2DBatch.h>
+
+#include <iostream>
+#include <algorithm>
+
+namespace {
+	const size_t numEpisodes = 40;
+	const size_t numRows = 4;
+	const int substeps = 14;
+
+	// Substeps of the whole run, to choose between interpreted and specialized rules
+	const int expectedSteps = static_cast<int>(numEpisodes * numRows) * substeps;
+
+	const float inputs[numRows][2] {
+		{ -10.0f, -10.0f },
+		{ -10.0f, 10.0f },
+		{ 10.0f, -10.0f },
+		{ 10.0f, 10.0f }
+	};
+}
+
+float ExperimentTruthTable::evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
+	const std::shared_ptr<cl::Image2D> &randomImage,
+	const std::shared_ptr<cl::Program> &blurProgram,
+	const std::shared_ptr<cl::Kernel> &blurKernelX,
+	const std::shared_ptr<cl::Kernel> &blurKernelY,
+	const std::vector<std::function<float(float)>> &activationFunctions,
+	const std::vector<std::string> &activationFunctionNames,
+	float minInitRec, float maxInitRec, erl::Logger &logger,
+	erl::ComputeSystem &cs, std::mt19937 &generator)
+{
+	return evaluateRuns(1, fieldGenes, pSettings, randomImage, blurProgram, blurKernelX, blurKernelY, activationFunctions, activationFunctionNames, minInitRec, maxInitRec, logger, cs, generator);
+}
+
+float ExperimentTruthTable::evaluateRuns(size_t numRuns, erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
+	const std::shared_ptr<cl::Image2D> &randomImage,
+	const std::shared_ptr<cl::Program> &blurProgram,
+	const std::shared_ptr<cl::Kernel> &blurKernelX,
+	const std::shared_ptr<cl::Kernel> &blurKernelY,
+	const std::vector<std::function<float(float)>> &activationFunctions,
+	const std::vector<std::string> &activationFunctionNames,
+	float minInitRec, float maxInitRec, erl::Logger &logger,
+	erl::ComputeSystem &cs, std::mt19937 &generator)
+{
+	erl::Field2DBatch fields;
+
+	fields._halfPrecisionRecurrents = _halfPrecisionRecurrents;
+
+	fields._expectedSteps = expectedSteps;
+
+	fields.create(numRuns, fieldGenes, cs, _fieldDimensions._width, _fieldDimensions._height, _fieldDimensions._connectionRadius, _fieldDimensions._numInputs, _fieldDimensions._numOutputs, _fieldDimensions._inputRange, _fieldDimensions._outputRange, randomImage, blurProgram, blurKernelX, blurKernelY, activationFunctions, activationFunctionNames, minInitRec, maxInitRec, generator, logger);
+
+	// Per run
+	std::vector<float> rewards(numRuns, 0.0f);
+	std::vector<float> prevRewards(numRuns, 0.0f);
+	std::vector<float> newRewards(numRuns);
+	std::vector<float> stepRewards(numRuns);
+
+	float totalReward = 0.0f;
+
+	for (size_t i = 0; i < numEpisodes; i++) {
+		std::fill(newRewards.begin(), newRewards.end(), 1.0f);
+
+		for (size_t j = 0; j < numRows; j++) {
+			for (size_t r = 0; r < numRuns; r++) {
+				fields.setInput(r, 0, inputs[j][0]);
+				fields.setInput(r, 1, inputs[j][1]);
+
+				stepRewards[r] = (rewards[r] - prevRewards[r]) * 10.0f;
+			}
+
+			fields.update(stepRewards, cs, activationFunctions, substeps, generator);
+
+			for (size_t r = 0; r < numRuns; r++)
+				newRewards[r] -= getRowPenalty(_targets[j], fields.getOutput(r, 0));
+		}
+
+		prevRewards = rewards;
+		rewards = newRewards;
+
+		for (size_t r = 0; r < numRuns; r++)
+			totalReward += rewards[r] * 0.5f;
+
+		cl::flush();
+	}
+
+	totalReward /= numRuns;
+
+	std::cout << "Finished " << _name << " experiment with total reward of " << totalReward << "." << std::endl;
+
+	return totalReward;
+}
+
+void ExperimentTruthTable::addNodeUpdateSources(size_t numRuns, erl::Field2DGenes &fieldGenes, const std::vector<std::string> &activationFunctionNames, erl::Logger &logger,
+	erl::ComputeSystem &cs, std::vector<std::string> &sources)
+{
+	erl::Field2DBatch fields;
+
+	fields._halfPrecisionRecurrents = _halfPrecisionRecurrents;
+
+	fields._expectedSteps = expectedSteps;
+
+	sources.push_back(fields.getNodeUpdateSource(numRuns, fieldGenes, cs, _fieldDimensions._width, _fieldDimensions._height, _fieldDimensions._connectionRadius, _fieldDimensions._numInputs, _fieldDimensions._numOutputs, _fieldDimensions._outputRange, activationFunctionNames, logger));
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+/*
+ERL
+
+Experiment Truth Table
+*/
+
+#pragma once
+
+#include <erl/simulation/Experiment.h>
+
+#include <array>
+#include <string>
+
+// Learning a two-input boolean function. All runs are stepped together in a Field2DBatch.
+// Experiments provide their table, field dimensions and how far an output is from its target
+class ExperimentTruthTable : public erl::Experiment {
+protected:
+	std::string _name;
+
+	// Target output for the inputs (false, false), (false, true), (true, false) and (true, true)
+	std::array<float, 4> _targets;
+
+	erl::FieldDimensions _fieldDimensions;
+
+	ExperimentTruthTable(const std::string &name, const std::array<float, 4> &targets, const erl::FieldDimensions &fieldDimensions)
+		: _name(name), _targets(targets), _fieldDimensions(fieldDimensions)
+	{}
+
+	// Reward lost in one row of the table
+	virtual float getRowPenalty(float target, float output) const = 0;
+
+public:
+	// Inherited from Experiment
+	float evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
+		const std::shared_ptr<cl::Image2D> &randomImage,
+		const std::shared_ptr<cl::Program> &blurProgram,
+		const std::shared_ptr<cl::Kernel> &blurKernelX,
+		const std::shared_ptr<cl::Kernel> &blurKernelY,
+		const std::vector<std::function<float(float)>> &activationFunctions,
+		const std::vector<std::string> &activationFunctionNames,
+		float minInitRec, float maxInitRec, erl::Logger &logger,
+		erl::ComputeSystem &cs, std::mt19937 &generator);
+
+	float evaluateRuns(size_t numRuns, erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
+		const std::shared_ptr<cl::Image2D> &randomImage,
+		const std::shared_ptr<cl::Program> &blurProgram,
+		const std::shared_ptr<cl::Kernel> &blurKernelX,
+		const std::shared_ptr<cl::Kernel> &blurKernelY,
+		const std::vector<std::function<float(float)>> &activationFunctions,
+		const std::vector<std::string> &activationFunctionNames,
+		float minInitRec, float maxInitRec, erl::Logger &logger,
+		erl::ComputeSystem &cs, std::mt19937 &generator);
+
+	void addNodeUpdateSources(size_t numRuns, erl::Field2DGenes &fieldGenes, const std::vector<std::string> &activationFunctionNames, erl::Logger &logger,
+		erl::ComputeSystem &cs, std::vector<std::string> &sources);
+};
\ No newline at end of file
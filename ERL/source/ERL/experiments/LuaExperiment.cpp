@@ -1,36 +1,207 @@
 #include <erl/experiments/LuaExperiment.h>
 
 #include <assert.h>
+#include <algorithm>
+#include <new>
+
+namespace {
+	// Register a function with the VM as its upvalue
+	void registerVMFunction(LuaExperiment::VM* pVM, const char* name, lua_CFunction function) {
+		lua_pushlightuserdata(pVM->_pLuaState, pVM);
+		lua_pushcclosure(pVM->_pLuaState, function, 1);
+		lua_setglobal(pVM->_pLuaState, name);
+	}
 
-LuaExperiment* _pCurrentExperiment = nullptr;
-int _lastHandle = 0;
-std::unordered_map<int, std::shared_ptr<erl::Field2DCL>> _handleToField;
+	LuaExperiment::VM* getVM(lua_State* pLuaState) {
+		return static_cast<LuaExperiment::VM*>(lua_touserdata(pLuaState, lua_upvalueindex(1)));
+	}
 
-LuaExperiment::LuaExperiment()
-: _pLuaState(nullptr), _fitness(0.0f)
-{
+	// Phenotype handles are userdata holding the field, released when the handle is collected
+	const char* phenotypeMetatableName = "erl.Phenotype";
+
+	// Float buffers for bulk input and output, the values follow the header in the userdata
+	const char* bufferMetatableName = "erl.PhenotypeBuffer";
+
+	struct PhenotypeHandle {
+		std::shared_ptr<erl::Field2DCL> _field;
+	};
+
+	struct PhenotypeBuffer {
+		int _size;
+
+		float* getValues() {
+			return reinterpret_cast<float*>(this + 1);
+		}
+	};
+
+	int phenotypeHandleGC(lua_State* pLuaState) {
+		static_cast<PhenotypeHandle*>(luaL_checkudata(pLuaState, 1, phenotypeMetatableName))->~PhenotypeHandle();
+
+		return 0;
+	}
+
+	erl::Field2DCL* checkPhenotype(lua_State* pLuaState, int index) {
+		PhenotypeHandle* pHandle = static_cast<PhenotypeHandle*>(luaL_checkudata(pLuaState, index, phenotypeMetatableName));
+
+		if (pHandle->_field == nullptr)
+			luaL_error(pLuaState, "phenotype was deleted");
+
+		return pHandle->_field.get();
+	}
+
+	// Whether the value is userdata with the named metatable, without raising an error like luaL_checkudata
+	bool isUserdataOf(lua_State* pLuaState, int index, const char* metatableName) {
+		if (lua_type(pLuaState, index) != LUA_TUSERDATA || !lua_getmetatable(pLuaState, index))
+			return false;
+
+		luaL_getmetatable(pLuaState, metatableName);
+
+		bool isOf = lua_rawequal(pLuaState, -1, -2) != 0;
+
+		lua_pop(pLuaState, 2);
+
+		return isOf;
+	}
+
+	// Returns nullptr if the value is not a buffer
+	PhenotypeBuffer* toBuffer(lua_State* pLuaState, int index) {
+		return isUserdataOf(pLuaState, index, bufferMetatableName) ? static_cast<PhenotypeBuffer*>(lua_touserdata(pLuaState, index)) : nullptr;
+	}
+
+	// Buffer elements are indexed from 1 like Lua arrays, element i + 1 holds input or output i
+	float* checkBufferElement(lua_State* pLuaState) {
+		PhenotypeBuffer* pBuffer = static_cast<PhenotypeBuffer*>(luaL_checkudata(pLuaState, 1, bufferMetatableName));
+
+		int index = static_cast<int>(luaL_checknumber(pLuaState, 2));
+
+		luaL_argcheck(pLuaState, index >= 1 && index <= pBuffer->_size, 2, "buffer index out of range");
+
+		return pBuffer->getValues() + index - 1;
+	}
+
+	int bufferIndex(lua_State* pLuaState) {
+		lua_pushnumber(pLuaState, *checkBufferElement(pLuaState));
+
+		return 1;
+	}
+
+	int bufferNewIndex(lua_State* pLuaState) {
+		*checkBufferElement(pLuaState) = static_cast<float>(luaL_checknumber(pLuaState, 3));
+
+		return 0;
+	}
+
+	int bufferLength(lua_State* pLuaState) {
+		lua_pushnumber(pLuaState, static_cast<PhenotypeBuffer*>(luaL_checkudata(pLuaState, 1, bufferMetatableName))->_size);
+
+		return 1;
+	}
+
+	void registerMetatables(lua_State* pLuaState) {
+		luaL_newmetatable(pLuaState, phenotypeMetatableName);
+		lua_pushcfunction(pLuaState, phenotypeHandleGC);
+		lua_setfield(pLuaState, -2, "__gc");
+		lua_pop(pLuaState, 1);
+
+		luaL_newmetatable(pLuaState, bufferMetatableName);
+		lua_pushcfunction(pLuaState, bufferIndex);
+		lua_setfield(pLuaState, -2, "__index");
+		lua_pushcfunction(pLuaState, bufferNewIndex);
+		lua_setfield(pLuaState, -2, "__newindex");
+		lua_pushcfunction(pLuaState, bufferLength);
+		lua_setfield(pLuaState, -2, "__len");
+		lua_pop(pLuaState, 1);
+	}
+
+	// Call a function stored in the registry, leaving numResults results on the stack. Logs and returns false on errors
+	bool callExperimentFunction(lua_State* pLuaState, int ref, int numResults, const std::string &fileName, erl::Logger &logger) {
+		lua_rawgeti(pLuaState, LUA_REGISTRYINDEX, ref);
+
+		if (lua_pcall(pLuaState, 0, numResults, 0) != 0) {
+			logger << "Error executing experiment \"" + fileName + "\":" + erl::endl + lua_tostring(pLuaState, -1) + erl::endl;
+
+			lua_pop(pLuaState, 1);
+
+			return false;
+		}
+
+		return true;
+	}
 }
 
-LuaExperiment::~LuaExperiment() {
-	if (_pLuaState != nullptr)
-		lua_close(_pLuaState);
+LuaExperiment::LuaExperiment()
+{}
+
+void LuaExperiment::create(const std::string &fileName, erl::Logger &logger, size_t numVMs) {
+	_shared.reset(new Shared());
+
+	_shared->_experimentFileName = fileName;
+
+	for (size_t i = 0; i < numVMs; i++)
+		_shared->_freeVMs.push_back(createVM(logger));
 }
 
-void LuaExperiment::create(const std::string &fileName) {
-	_pLuaState = luaL_newstate();
+LuaExperiment::VM* LuaExperiment::createVM(erl::Logger &logger) {
+	std::unique_ptr<VM> vm(new VM());
 
-	_experimentFileName = fileName;
+	vm->_pLuaState = luaL_newstate();
 
 	// Open libraries
-	luaL_openlibs(_pLuaState);
+	luaL_openlibs(vm->_pLuaState);
+
+	registerMetatables(vm->_pLuaState);
 
 	// Register functions
-	lua_register(_pLuaState, "generatePhenotype", generatePhenotype);
-	lua_register(_pLuaState, "deletePhenotype", deletePhenotype);
-	lua_register(_pLuaState, "setPhenotypeInput", setPhenotypeInput);
-	lua_register(_pLuaState, "stepPhenotype", stepPhenotype);
-	lua_register(_pLuaState, "getPhenotypeOutput", getPhenotypeOutput);
-	lua_register(_pLuaState, "setFitness", setFitness);
+	registerVMFunction(vm.get(), "generatePhenotype", generatePhenotype);
+	registerVMFunction(vm.get(), "deletePhenotype", deletePhenotype);
+	registerVMFunction(vm.get(), "setPhenotypeInput", setPhenotypeInput);
+	registerVMFunction(vm.get(), "stepPhenotype", stepPhenotype);
+	registerVMFunction(vm.get(), "stepPhenotypes", stepPhenotypes);
+	registerVMFunction(vm.get(), "getPhenotypeOutput", getPhenotypeOutput);
+	registerVMFunction(vm.get(), "setPhenotypeInputs", setPhenotypeInputs);
+	registerVMFunction(vm.get(), "getPhenotypeOutputs", getPhenotypeOutputs);
+	registerVMFunction(vm.get(), "newPhenotypeBuffer", newPhenotypeBuffer);
+	registerVMFunction(vm.get(), "setFitness", setFitness);
+
+	if (luaL_loadfile(vm->_pLuaState, _shared->_experimentFileName.c_str()) != 0) {
+		logger << "Error loading experiment \"" + _shared->_experimentFileName + "\":" + erl::endl + lua_tostring(vm->_pLuaState, -1) + erl::endl;
+
+		abort();
+	}
+
+	vm->_chunkRef = luaL_ref(vm->_pLuaState, LUA_REGISTRYINDEX);
+
+	VM* pVM = vm.get();
+
+	_shared->_vms.push_back(std::move(vm));
+
+	return pVM;
+}
+
+LuaExperiment::VM* LuaExperiment::acquireVM(erl::Logger &logger) {
+	std::lock_guard<std::mutex> lock(_shared->_mutex);
+
+	if (_shared->_freeVMs.empty())
+		return createVM(logger);
+
+	VM* pVM = _shared->_freeVMs.back();
+
+	_shared->_freeVMs.pop_back();
+
+	return pVM;
+}
+
+void LuaExperiment::releaseVM(VM* pVM) {
+	std::lock_guard<std::mutex> lock(_shared->_mutex);
+
+	_shared->_freeVMs.push_back(pVM);
+}
+
+void LuaExperiment::addFieldDesc(const FieldDesc &desc) {
+	std::lock_guard<std::mutex> lock(_shared->_mutex);
+
+	if (std::find(_shared->_fieldDescs.begin(), _shared->_fieldDescs.end(), desc) == _shared->_fieldDescs.end())
+		_shared->_fieldDescs.push_back(desc);
 }
 
 float LuaExperiment::evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
@@ -43,9 +214,7 @@ float LuaExperiment::evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DE
 	float minInitRec, float maxInitRec, erl::Logger &logger,
 	erl::ComputeSystem &cs, std::mt19937 &generator)
 {
-	assert(_pLuaState != nullptr);
-
-	_pCurrentExperiment = this;
+	assert(_shared != nullptr);
 
 	_pFieldGenes = &fieldGenes;
 	_pSettings = pSettings;
@@ -61,18 +230,55 @@ float LuaExperiment::evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DE
 	_pCs = &cs;
 	_pGenerator = &generator;
 
-	_lastHandle = 0;
-	_handleToField.clear();
-	
-	int s = luaL_dofile(_pLuaState, _experimentFileName.c_str());
+	VM* pVM = acquireVM(logger);
+
+	pVM->_pExperiment = this;
+
+	// Scripts that fail or never call setFitness score 0, not what the last genotype on this VM left
+	pVM->_fitness = 0.0f;
+
+	if (pVM->_runRef != LUA_NOREF)
+		callExperimentFunction(pVM->_pLuaState, pVM->_runRef, 0, _shared->_experimentFileName, logger);
+	else if (callExperimentFunction(pVM->_pLuaState, pVM->_chunkRef, 1, _shared->_experimentFileName, logger)) {
+		if (lua_isfunction(pVM->_pLuaState, -1)) {
+			// The chunk only set up, keep its run function and run this evaluation with it
+			pVM->_runRef = luaL_ref(pVM->_pLuaState, LUA_REGISTRYINDEX);
 
-	if (s != 0) {
-		std::cerr << "Error executing experiment \"" << _experimentFileName << "\":" << std::endl;
-		std::cerr << lua_tostring(_pLuaState, -1) << std::endl;
-		lua_pop(_pLuaState, 1);
+			callExperimentFunction(pVM->_pLuaState, pVM->_runRef, 0, _shared->_experimentFileName, logger);
+		}
+		else
+			lua_pop(pVM->_pLuaState, 1);
 	}
 
-	return _fitness;
+	float fitness = pVM->_fitness;
+
+	// Collect the handles now to free their fields, the VM may next run on another thread
+	lua_gc(pVM->_pLuaState, LUA_GCCOLLECT, 0);
+
+	releaseVM(pVM);
+
+	return fitness;
+}
+
+void LuaExperiment::addNodeUpdateSources(size_t, erl::Field2DGenes &fieldGenes, const std::vector<std::string> &activationFunctionNames, erl::Logger &logger,
+	erl::ComputeSystem &cs, std::vector<std::string> &sources)
+{
+	std::vector<FieldDesc> fieldDescs;
+
+	{
+		std::lock_guard<std::mutex> lock(_shared->_mutex);
+
+		fieldDescs = _shared->_fieldDescs;
+	}
+
+	for (size_t i = 0; i < fieldDescs.size(); i++) {
+		erl::Field2DCL field;
+
+		field._halfPrecisionRecurrents = _halfPrecisionRecurrents;
+
+		sources.push_back(field.getNodeUpdateSource(fieldGenes, cs, fieldDescs[i]._width, fieldDescs[i]._height, fieldDescs[i]._connectionRadius,
+			fieldDescs[i]._numInputs, fieldDescs[i]._numOutputs, fieldDescs[i]._outputRange, activationFunctionNames, logger));
+	}
 }
 
 int generatePhenotype(lua_State* pLuaState) {
@@ -88,19 +294,36 @@ int generatePhenotype(lua_State* pLuaState) {
 	int argInputRange = lua_tonumber(pLuaState, 6);
 	int argOutputRange = lua_tonumber(pLuaState, 7);
 
-	_lastHandle++;
+	LuaExperiment::FieldDesc desc;
+
+	desc._width = argWidth;
+	desc._height = argHeight;
+	desc._connectionRadius = argConnectionRadius;
+	desc._numInputs = argNumInputs;
+	desc._numOutputs = argNumOutputs;
+	desc._outputRange = argOutputRange;
+
+	LuaExperiment::VM* pVM = getVM(pLuaState);
+	LuaExperiment* pExperiment = pVM->_pExperiment;
+
+	pExperiment->addFieldDesc(desc);
 
 	std::shared_ptr<erl::Field2DCL> field(new erl::Field2DCL());
 
-	field->create(*_pCurrentExperiment->_pFieldGenes, *_pCurrentExperiment->_pCs, argWidth, argHeight, argConnectionRadius,
-		argNumInputs, argNumOutputs, argInputRange, argOutputRange, _pCurrentExperiment->_randomImage,
-		_pCurrentExperiment->_blurProgram, _pCurrentExperiment->_blurKernelX, _pCurrentExperiment->_blurKernelY,
-		_pCurrentExperiment->_activationFunctions, _pCurrentExperiment->_activationFunctionNames,
-		_pCurrentExperiment->_minInitRec, _pCurrentExperiment->_maxInitRec, *_pCurrentExperiment->_pGenerator, *_pCurrentExperiment->_pLogger);
+	field->_halfPrecisionRecurrents = pExperiment->_halfPrecisionRecurrents;
+
+	field->create(*pExperiment->_pFieldGenes, *pExperiment->_pCs, argWidth, argHeight, argConnectionRadius,
+		argNumInputs, argNumOutputs, argInputRange, argOutputRange, pExperiment->_randomImage,
+		pExperiment->_blurProgram, pExperiment->_blurKernelX, pExperiment->_blurKernelY,
+		pExperiment->_activationFunctions, pExperiment->_activationFunctionNames,
+		pExperiment->_minInitRec, pExperiment->_maxInitRec, *pExperiment->_pGenerator, *pExperiment->_pLogger);
+
+	PhenotypeHandle* pHandle = new (lua_newuserdata(pLuaState, sizeof(PhenotypeHandle))) PhenotypeHandle();
 
-	_handleToField[_lastHandle] = field;
+	pHandle->_field = field;
 
-	lua_pushnumber(pLuaState, _lastHandle);
+	luaL_getmetatable(pLuaState, phenotypeMetatableName);
+	lua_setmetatable(pLuaState, -2);
 
 	return 1; // number of return values
 }
@@ -110,12 +333,7 @@ int deletePhenotype(lua_State* pLuaState) {
 
 	assert(argc == 1);
 
-	int arg = lua_tonumber(pLuaState, 1);
-
-	std::unordered_map<int, std::shared_ptr<erl::Field2DCL>>::iterator it = _handleToField.find(arg);
-
-	if (it != _handleToField.end())
-		_handleToField.erase(it);
+	static_cast<PhenotypeHandle*>(luaL_checkudata(pLuaState, 1, phenotypeMetatableName))->_field.reset();
 
 	return 0;
 }
@@ -125,11 +343,11 @@ int setPhenotypeInput(lua_State* pLuaState) {
 
 	assert(argc == 3);
 
-	int argField = lua_tonumber(pLuaState, 1);
+	erl::Field2DCL* pField = checkPhenotype(pLuaState, 1);
 	int argIndex = lua_tonumber(pLuaState, 2);
 	float argValue = lua_tonumber(pLuaState, 3);
 
-	_handleToField[argField]->setInput(argIndex, argValue);
+	pField->setInput(argIndex, argValue);
 
 	return 0;
 }
@@ -139,11 +357,95 @@ int stepPhenotype(lua_State* pLuaState) {
 
 	assert(argc == 3);
 
-	int argField = lua_tonumber(pLuaState, 1);
+	erl::Field2DCL* pField = checkPhenotype(pLuaState, 1);
 	float argReward = lua_tonumber(pLuaState, 2);
 	int argSubSteps = lua_tonumber(pLuaState, 3);
 
-	_handleToField[argField]->update(argReward, *_pCurrentExperiment->_pCs, _pCurrentExperiment->_activationFunctions, argSubSteps, *_pCurrentExperiment->_pGenerator);
+	LuaExperiment::VM* pVM = getVM(pLuaState);
+
+	pField->update(argReward, *pVM->_pExperiment->_pCs, pVM->_pExperiment->_activationFunctions, argSubSteps, *pVM->_pExperiment->_pGenerator);
+
+	return 0;
+}
+
+// Steps several phenotypes with one sync point. All fields are enqueued before the first wait, so the device works on
+// later fields while the host decodes earlier ones. Rewards are a table with one reward per handle, or one number for all.
+// Each handle may appear once
+int stepPhenotypes(lua_State* pLuaState) {
+	int argc = lua_gettop(pLuaState);
+
+	assert(argc == 3);
+
+	luaL_checktype(pLuaState, 1, LUA_TTABLE);
+
+	bool sharedReward = lua_type(pLuaState, 2) == LUA_TNUMBER;
+
+	if (!sharedReward)
+		luaL_checktype(pLuaState, 2, LUA_TTABLE);
+
+	int argSubSteps = lua_tonumber(pLuaState, 3);
+
+	// Check all handles and rewards before enqueuing anything, so an error does not leave fields half updated
+	std::vector<erl::Field2DCL*> fields;
+	std::vector<float> rewards;
+
+	for (int i = 1;; i++) {
+		lua_rawgeti(pLuaState, 1, i);
+
+		if (lua_isnil(pLuaState, -1)) {
+			lua_pop(pLuaState, 1);
+
+			break;
+		}
+
+		if (!isUserdataOf(pLuaState, -1, phenotypeMetatableName))
+			luaL_error(pLuaState, "element %d of the phenotype table is not a phenotype handle", i);
+
+		erl::Field2DCL* pField = static_cast<PhenotypeHandle*>(lua_touserdata(pLuaState, -1))->_field.get();
+
+		lua_pop(pLuaState, 1);
+
+		if (pField == nullptr)
+			luaL_error(pLuaState, "phenotype %d was deleted", i);
+
+		// A second update of the same field would start before its first output read finished, and overwrite it
+		std::vector<erl::Field2DCL*>::const_iterator duplicate = std::find(fields.begin(), fields.end(), pField);
+
+		if (duplicate != fields.end())
+			luaL_error(pLuaState, "handle %d repeats handle %d, a phenotype may only be stepped once per call", i, static_cast<int>(duplicate - fields.begin()) + 1);
+
+		fields.push_back(pField);
+
+		if (sharedReward)
+			rewards.push_back(static_cast<float>(lua_tonumber(pLuaState, 2)));
+		else {
+			lua_rawgeti(pLuaState, 2, i);
+
+			if (lua_type(pLuaState, -1) != LUA_TNUMBER)
+				luaL_error(pLuaState, "reward %d is not a number, the reward table needs one number per handle", i);
+
+			rewards.push_back(static_cast<float>(lua_tonumber(pLuaState, -1)));
+
+			lua_pop(pLuaState, 1);
+		}
+	}
+
+	if (!sharedReward) {
+		lua_rawgeti(pLuaState, 2, static_cast<int>(fields.size()) + 1);
+
+		if (!lua_isnil(pLuaState, -1))
+			luaL_error(pLuaState, "the reward table has more entries than the %d handles", static_cast<int>(fields.size()));
+
+		lua_pop(pLuaState, 1);
+	}
+
+	LuaExperiment::VM* pVM = getVM(pLuaState);
+
+	for (size_t i = 0; i < fields.size(); i++)
+		fields[i]->beginUpdate(rewards[i], *pVM->_pExperiment->_pCs, pVM->_pExperiment->_activationFunctions, argSubSteps, *pVM->_pExperiment->_pGenerator);
+
+	for (size_t i = 0; i < fields.size(); i++)
+		fields[i]->endUpdate(pVM->_pExperiment->_activationFunctions);
 
 	return 0;
 }
@@ -153,16 +455,103 @@ int getPhenotypeOutput(lua_State* pLuaState) {
 
 	assert(argc == 2);
 
-	int argField = lua_tonumber(pLuaState, 1);
+	erl::Field2DCL* pField = checkPhenotype(pLuaState, 1);
 	int argIndex = lua_tonumber(pLuaState, 2);
 
-	float output = _handleToField[argField]->getOutput(argIndex);
+	float output = pField->getOutput(argIndex);
 
 	lua_pushnumber(pLuaState, output);
 
 	return 1;
 }
 
+int setPhenotypeInputs(lua_State* pLuaState) {
+	int argc = lua_gettop(pLuaState);
+
+	assert(argc == 2);
+
+	erl::Field2DCL* pField = checkPhenotype(pLuaState, 1);
+
+	if (PhenotypeBuffer* pBuffer = toBuffer(pLuaState, 2)) {
+		int count = std::min(pBuffer->_size, pField->getNumInputs());
+
+		for (int i = 0; i < count; i++)
+			pField->setInput(i, pBuffer->getValues()[i]);
+	}
+	else {
+		luaL_checktype(pLuaState, 2, LUA_TTABLE);
+
+		// Inputs past the end of the table keep their values
+		for (int i = 0; i < pField->getNumInputs(); i++) {
+			lua_rawgeti(pLuaState, 2, i + 1);
+
+			bool isNil = lua_isnil(pLuaState, -1);
+
+			if (!isNil)
+				pField->setInput(i, lua_tonumber(pLuaState, -1));
+
+			lua_pop(pLuaState, 1);
+
+			if (isNil)
+				break;
+		}
+	}
+
+	return 0;
+}
+
+// Fills the given table or buffer with the outputs and returns it, or returns a new table
+int getPhenotypeOutputs(lua_State* pLuaState) {
+	int argc = lua_gettop(pLuaState);
+
+	assert(argc == 1 || argc == 2);
+
+	erl::Field2DCL* pField = checkPhenotype(pLuaState, 1);
+
+	if (argc == 2) {
+		if (PhenotypeBuffer* pBuffer = toBuffer(pLuaState, 2)) {
+			int count = std::min(pBuffer->_size, pField->getNumOutputs());
+
+			for (int i = 0; i < count; i++)
+				pBuffer->getValues()[i] = pField->getOutput(i);
+
+			return 1;
+		}
+
+		luaL_checktype(pLuaState, 2, LUA_TTABLE);
+	}
+	else
+		lua_createtable(pLuaState, pField->getNumOutputs(), 0);
+
+	for (int i = 0; i < pField->getNumOutputs(); i++) {
+		lua_pushnumber(pLuaState, pField->getOutput(i));
+		lua_rawseti(pLuaState, -2, i + 1);
+	}
+
+	return 1;
+}
+
+int newPhenotypeBuffer(lua_State* pLuaState) {
+	int argc = lua_gettop(pLuaState);
+
+	assert(argc == 1);
+
+	int argSize = static_cast<int>(luaL_checknumber(pLuaState, 1));
+
+	luaL_argcheck(pLuaState, argSize >= 0, 1, "negative buffer size");
+
+	PhenotypeBuffer* pBuffer = static_cast<PhenotypeBuffer*>(lua_newuserdata(pLuaState, sizeof(PhenotypeBuffer) + argSize * sizeof(float)));
+
+	pBuffer->_size = argSize;
+
+	std::fill(pBuffer->getValues(), pBuffer->getValues() + argSize, 0.0f);
+
+	luaL_getmetatable(pLuaState, bufferMetatableName);
+	lua_setmetatable(pLuaState, -2);
+
+	return 1;
+}
+
 int setFitness(lua_State* pLuaState) {
 	int argc = lua_gettop(pLuaState);
 
@@ -170,7 +559,7 @@ int setFitness(lua_State* pLuaState) {
 
 	float argFitness = lua_tonumber(pLuaState, 1);
 
-	_pCurrentExperiment->_fitness = argFitness;
+	getVM(pLuaState)->_fitness = argFitness;
 
 	return 0;
 }
\ No newline at end of file
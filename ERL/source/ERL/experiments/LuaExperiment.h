@@ -11,13 +11,68 @@ Lua Experiment
 
 #include <erl/simulation/Experiment.h>
 
-#include <unordered_map>
+#include <mutex>
 
 class LuaExperiment : public erl::Experiment {
+public:
+	// A Lua state with the experiment functions registered, and the state of the evaluation running on it.
+	// The functions find it through their upvalue, so several VMs can run at once
+	struct VM : public erl::Uncopyable {
+		lua_State* _pLuaState;
+
+		// Registry references to the compiled experiment chunk, and to the run function it returned, if any
+		int _chunkRef;
+		int _runRef;
+
+		// Experiment evaluating on this VM
+		LuaExperiment* _pExperiment;
+
+		float _fitness;
+
+		VM()
+			: _pLuaState(nullptr), _chunkRef(LUA_NOREF), _runRef(LUA_NOREF), _pExperiment(nullptr), _fitness(0.0f)
+		{}
+
+		~VM() {
+			if (_pLuaState != nullptr)
+				lua_close(_pLuaState);
+		}
+	};
+
+	// Dimensions of a field created by the script
+	struct FieldDesc {
+		int _width, _height;
+		int _connectionRadius;
+		int _numInputs, _numOutputs;
+		int _outputRange;
+
+		bool operator==(const FieldDesc &other) const {
+			return _width == other._width && _height == other._height && _connectionRadius == other._connectionRadius &&
+				_numInputs == other._numInputs && _numOutputs == other._numOutputs && _outputRange == other._outputRange;
+		}
+	};
+
 private:
-	lua_State* _pLuaState;
+	// VMs and field descriptions of an experiment file, shared by an experiment and its clones
+	struct Shared {
+		std::string _experimentFileName;
+
+		std::mutex _mutex;
+
+		std::vector<std::unique_ptr<VM>> _vms;
+		std::vector<VM*> _freeVMs;
+
+		// Fields created in previous evaluations. Scripts usually create the same fields for every genotype, so these predict the next fields
+		std::vector<FieldDesc> _fieldDescs;
+	};
+
+	std::shared_ptr<Shared> _shared;
+
+	// Take a free VM, creating one if all are in use
+	VM* acquireVM(erl::Logger &logger);
+	void releaseVM(VM* pVM);
 
-	std::string _experimentFileName;
+	VM* createVM(erl::Logger &logger);
 
 public:
 	erl::Field2DGenes* _pFieldGenes;
@@ -34,12 +89,15 @@ public:
 	erl::ComputeSystem* _pCs;
 	std::mt19937* _pGenerator;
 
-	float _fitness;
-
 	LuaExperiment();
-	~LuaExperiment();
 
-	void create(const std::string &fileName);
+	// Create numVMs VMs up front, more are created when more evaluations run at once. Each VM compiles the experiment once.
+	// A script that returns a function only runs its top level once per VM, later evaluations call the returned function.
+	// Other scripts run whole for every evaluation
+	void create(const std::string &fileName, erl::Logger &logger, size_t numVMs = 1);
+
+	// Record a field the script created
+	void addFieldDesc(const FieldDesc &desc);
 
 	// Inherited from Experiment
 	float evaluate(erl::Field2DGenes &fieldGenes, const erl::Field2DEvolverSettings* pSettings,
@@ -51,17 +109,26 @@ public:
 		const std::vector<std::string> &activationFunctionNames,
 		float minInitRec, float maxInitRec, erl::Logger &logger,
 		erl::ComputeSystem &cs, std::mt19937 &generator);
-};
 
-extern LuaExperiment* _pCurrentExperiment;
-extern int _lastHandle;
-extern std::unordered_map<int, std::shared_ptr<erl::Field2DCL>> _handleToField;
+	void addNodeUpdateSources(size_t numRuns, erl::Field2DGenes &fieldGenes, const std::vector<std::string> &activationFunctionNames, erl::Logger &logger,
+		erl::ComputeSystem &cs, std::vector<std::string> &sources);
+
+	// Clones share the VM pool
+	std::shared_ptr<erl::Experiment> clone() const {
+		return std::make_shared<LuaExperiment>(*this);
+	}
+};
 
 int generatePhenotype(lua_State* pLuaState);
 int deletePhenotype(lua_State* pLuaState);
 
 int setPhenotypeInput(lua_State* pLuaState);
 int stepPhenotype(lua_State* pLuaState);
+int stepPhenotypes(lua_State* pLuaState);
 int getPhenotypeOutput(lua_State* pLuaState);
 
+int setPhenotypeInputs(lua_State* pLuaState);
+int getPhenotypeOutputs(lua_State* pLuaState);
+int newPhenotypeBuffer(lua_State* pLuaState);
+
 int setFitness(lua_State* pLuaState);
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include <erl/field/Field2DBatch.h>
+
+#include <assert.h>
+
+using namespace erl;
+
+void Field2DBatch::create(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+	int inputRange, int outputRange,
+	const std::shared_ptr<cl::Image2D> &randomImage,
+	const std::shared_ptr<cl::Program> &gasBlurProgram,
+	const std::shared_ptr<cl::Kernel> &gasBlurKernelX,
+	const std::shared_ptr<cl::Kernel> &gasBlurKernelY,
+	const std::vector<std::function<float(float)>> &activationFunctions, const std::vector<std::string> &activationFunctionNames,
+	float minRecInit, float maxRecInit, std::mt19937 &generator,
+	Logger &logger)
+{
+	createFields(numFields, genes, cs, width, height, connectionRadius, numInputs, numOutputs, inputRange, outputRange,
+		randomImage, gasBlurProgram, gasBlurKernelX, gasBlurKernelY,
+		activationFunctions, activationFunctionNames, minRecInit, maxRecInit, generator, logger);
+}
+
+std::string Field2DBatch::getNodeUpdateSource(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+	int outputRange, const std::vector<std::string> &activationFunctionNames, Logger &logger)
+{
+	return fieldsNodeUpdateSource(numFields, genes, cs, width, height, connectionRadius, numInputs, numOutputs, outputRange, activationFunctionNames, logger);
+}
+
+void Field2DBatch::update(const std::vector<float> &rewards, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator) {
+	beginUpdate(rewards, cs, activationFunctions, substeps, generator);
+	endUpdate(activationFunctions);
+}
+
+void Field2DBatch::beginUpdate(const std::vector<float> &rewards, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator) {
+	assert(static_cast<int>(rewards.size()) == _numFields);
+
+	std::copy(rewards.begin(), rewards.end(), _rewards.begin());
+
+	beginUpdateFields(cs, activationFunctions, substeps, generator);
+}
+
+void Field2DBatch::endUpdate(const std::vector<std::function<float(float)>> &activationFunctions) {
+	endUpdateFields(activationFunctions);
+}
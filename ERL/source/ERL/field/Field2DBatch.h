@@ -0,0 +1,62 @@
+/*
+ERL
+
+Field2D Batch
+*/
+
+#pragma once
+
+#include <erl/field/Field2DCL.h>
+
+namespace erl {
+	// Steps many fields created from the same genes with a single kernel launch per substep.
+	// Inherits privately, since the single field update, setInput and getOutput of Field2DCL would only address the first field
+	class Field2DBatch : private Field2DCL {
+	public:
+		using Field2DCL::_numGasBlurPasses;
+		using Field2DCL::_stateLayout;
+		using Field2DCL::_gatherTileSize;
+		using Field2DCL::_allowSubstepKernel;
+		using Field2DCL::_allowGasDiffusionKernel;
+		using Field2DCL::_ruleWeightsInBuffer;
+		using Field2DCL::_halfPrecisionRecurrents;
+		using Field2DCL::_maxUnrolledConnections;
+		using Field2DCL::_ruleEvaluation;
+		using Field2DCL::_expectedSteps;
+		using Field2DCL::_interpreterBreakEvenSteps;
+
+		using Field2DCL::getWidth;
+		using Field2DCL::getHeight;
+		using Field2DCL::getNumInputs;
+		using Field2DCL::getNumOutputs;
+		using Field2DCL::getNumFields;
+
+		void create(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+			int inputRange, int outputRange,
+			const std::shared_ptr<cl::Image2D> &randomImage,
+			const std::shared_ptr<cl::Program> &gasBlurProgram,
+			const std::shared_ptr<cl::Kernel> &gasBlurKernelX,
+			const std::shared_ptr<cl::Kernel> &gasBlurKernelY,
+			const std::vector<std::function<float(float)>> &activationFunctions, const std::vector<std::string> &activationFunctionNames,
+			float minRecInit, float maxRecInit, std::mt19937 &generator,
+			Logger &logger);
+
+		// Source of the node update program create would build for numFields fields with the same arguments and options, without creating them
+		std::string getNodeUpdateSource(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+			int outputRange, const std::vector<std::string> &activationFunctionNames, Logger &logger);
+
+		// One reward per field
+		void update(const std::vector<float> &rewards, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator);
+
+		void beginUpdate(const std::vector<float> &rewards, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator);
+		void endUpdate(const std::vector<std::function<float(float)>> &activationFunctions);
+
+		void setInput(int fieldIndex, int index, float value) {
+			_inputs[fieldIndex * _numInputs + index] = value;
+		}
+
+		float getOutput(int fieldIndex, int index) const {
+			return _outputs[fieldIndex * _numOutputs + index];
+		}
+	};
+}
@@ -1,11 +1,14 @@
 #include <erl/field/Field2DCL.h>
 
 #include <erl/platform/Field2DGenesToCL.h>
+#include <erl/platform/HalfFloat.h>
+
+#include <algorithm>
 
 using namespace erl;
 
 Field2DCL::Field2DCL()
-: _numGasBlurPasses(4)
+: _numGasBlurPasses(4), _stateLayout(_arrayOfStructures), _gatherTileSize(0), _allowSubstepKernel(true), _allowGasDiffusionKernel(true), _ruleWeightsInBuffer(true), _halfPrecisionRecurrents(false), _maxUnrolledConnections(25), _ruleEvaluation(_specialized), _expectedSteps(0), _interpreterBreakEvenSteps(0)
 {}
 
 void Field2DCL::create(Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
@@ -18,20 +21,17 @@ void Field2DCL::create(Field2DGenes &genes, ComputeSystem &cs, int width, int he
 	float minRecInit, float maxRecInit, std::mt19937 &generator,
 	Logger &logger)
 {
-	cl_int err;
-
-	_currentReadBufferIndex = 0;
-	_currentWriteBufferIndex = 1;
+	createFields(1, genes, cs, width, height, connectionRadius, numInputs, numOutputs, inputRange, outputRange,
+		randomImage, gasBlurProgram, gasBlurKernelX, gasBlurKernelY, activationFunctions, activationFunctionNames,
+		minRecInit, maxRecInit, generator, logger);
+}
 
+void Field2DCL::setDimensions(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+	int outputRange, Logger &logger)
+{
 	_numGases = genes._numGases;
 	_typeSize = genes._typeSize;
 
-	_randomImage = randomImage;
-
-	_gasBlurProgram = gasBlurProgram;
-	_gasBlurKernelX = gasBlurKernelX;
-	_gasBlurKernelY = gasBlurKernelY;
-
 	_connectionResponseSize = genes.getConnectionResponseSize();
 	_nodeOutputSize = genes.getNodeOutputSize();
 
@@ -39,11 +39,10 @@ void Field2DCL::create(Field2DGenes &genes, ComputeSystem &cs, int width, int he
 	_height = height;
 	_connectionRadius = connectionRadius;
 
-	_inputs.clear();
-	_inputs.assign(numInputs, 0.0f);
+	_numFields = numFields;
 
-	_outputs.clear();
-	_outputs.assign(numOutputs, 0.0f);
+	_numInputs = numInputs;
+	_numOutputs = numOutputs;
 
 	_inputStrengthScalar = genes.getInputStrengthScalar();
 	_connectionStrengthScalar = genes.getConnectionStrengthScalar();
@@ -59,75 +58,214 @@ void Field2DCL::create(Field2DGenes &genes, ComputeSystem &cs, int width, int he
 	_connectionDimensionSize = 2 * _connectionRadius + 1;
 	_numConnections = _connectionDimensionSize * _connectionDimensionSize;
 
+	_unrollConnections = _numConnections <= _maxUnrolledConnections;
+
 	_nodeSize = genes.getNodeOutputSize() + _typeSize + _nodePhenotype.getRecurrentDataSize();
 	_connectionSize = _connectionPhenotype.getRecurrentDataSize();
 	_nodeAndConnectionsSize = _nodeSize + _connectionSize * _numConnections;
 
 	_numNodes = _width * _height;
 
-	_bufferSize = _nodeAndConnectionsSize * _numNodes;
+	_nodeStateSize = genes.getNodeOutputSize();
+	_recurrentStateSize = _nodePhenotype.getRecurrentDataSize() + _connectionSize * _numConnections;
 
-	std::vector<float> buffer(_bufferSize);
+	_bufferSize = _nodeStateSize * _numNodes;
+	_recurrentBufferSize = _recurrentStateSize * _numNodes;
 
-	// Type phenotype
-	ne::Phenotype typePhenotype;
+	if (_stateLayout == _structureOfArrays) {
+		_nodeStride = 1;
+		_recurrentNodeStride = 1;
+		_typeNodeStride = 1;
+		_slotStride = _numNodes;
+	}
+	else {
+		_nodeStride = _nodeStateSize;
+		_recurrentNodeStride = _recurrentStateSize;
+		_typeNodeStride = _typeSize;
+		_slotStride = 1;
+	}
 
-	typePhenotype.createFromGenotype(genes.getTypeSetGenotype());
+	// Tiles must divide the field, so take the largest divisors that fit the requested tile size
+	_tileWidth = 0;
+	_tileHeight = 0;
 
-	// Create buffer
-	int bufferIndex = 0;
+	if (_gatherTileSize > 0) {
+		for (int d = std::min(_gatherTileSize, _width); d > 0; d--)
+			if (_width % d == 0) {
+				_tileWidth = d;
+				break;
+			}
 
-	float widthf = static_cast<float>(_width);
-	float heightf = static_cast<float>(_height);
+		for (int d = std::min(_gatherTileSize, _height); d > 0; d--)
+			if (_height % d == 0) {
+				_tileHeight = d;
+				break;
+			}
 
-	std::uniform_real_distribution<float> distRecInit(minRecInit, maxRecInit);
+		size_t tileLocalMemSize = (_tileWidth + 2 * _connectionRadius) * (_tileHeight + 2 * _connectionRadius) * (_nodeOutputSize + _typeSize) * sizeof(float);
 
-	// Resize init buffers if necessary (add entries)
-	while (genes._recurrentNodeInitBounds.size() < _nodePhenotype.getRecurrentDataSize()) {
-		std::tuple<float, float> newBounds = std::make_tuple<float, float>(distRecInit(generator), distRecInit(generator));
+		if (static_cast<size_t>(_tileWidth * _tileHeight) > cs.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>() || tileLocalMemSize > cs.getDevice().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()) {
+			logger << "Gather tile does not fit the device, using untiled gather" + erl::endl;
 
-		if (std::get<0>(newBounds) > std::get<1>(newBounds))
-			std::get<0>(newBounds) = std::get<1>(newBounds) = (std::get<0>(newBounds) + std::get<1>(newBounds)) * 0.5f;
+			_tileWidth = 0;
+			_tileHeight = 0;
+		}
+	}
+
+	// The whole field as one work-group, with its node outputs (double buffered) and types in local memory
+	size_t substepLocalMemSize = (2 * _nodeOutputSize + std::max(1, _typeSize)) * _numNodes * sizeof(float);
+
+	_useSubstepKernel = _allowSubstepKernel && static_cast<size_t>(_numNodes) <= cs.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>() && substepLocalMemSize <= cs.getDevice().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+}
+
+std::string Field2DCL::nodeUpdateSource(Field2DGenes &genes, ComputeSystem &cs, const std::vector<std::string> &activationFunctionNames, std::vector<float> &ruleWeights, std::vector<int> &ruleCode) {
+	ruleWeights.clear();
+	ruleCode.clear();
+
+	bool interpret = _ruleEvaluation == _interpreted;
+
+	std::string specializedSource;
+	std::vector<float> specializedWeights;
+
+	// Interpret the rules when building the specialized program would take longer than the interpreter loses over the steps of all fields sharing the program.
+	// A specialized program that is already cached costs no build, so it is always used
+	if (_ruleEvaluation == _automatic && _expectedSteps > 0 && static_cast<long long>(_expectedSteps) * _numFields < _interpreterBreakEvenSteps) {
+		specializedSource = specializedNodeUpdateSource(genes, cs, activationFunctionNames, specializedWeights);
+
+		interpret = !cs.getProgramCache().contains(cs.getDevice(), specializedSource, "");
+	}
+
+	if (interpret) {
+		std::string source = field2DGenesNodeUpdateToCL(genes, *this, _connectionPhenotype, _nodePhenotype, activationFunctionNames, _width, _height, _connectionRadius, _numInputs, _numOutputs, &ruleWeights, &ruleCode);
 
-		genes._recurrentNodeInitBounds.push_back(newBounds);
+		size_t maxConstantBufferSize = cs.getDevice().getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+
+		if (!ruleCode.empty() && ruleWeights.size() * sizeof(float) <= maxConstantBufferSize && ruleCode.size() * sizeof(int) <= maxConstantBufferSize)
+			return source;
+
+		ruleWeights.clear();
+		ruleCode.clear();
 	}
 
-	while (genes._recurrentConnectionInitBounds.size() < _connectionPhenotype.getRecurrentDataSize()) {
-		std::tuple<float, float> newBounds = std::make_tuple<float, float>(distRecInit(generator), distRecInit(generator));
+	if (specializedSource.empty())
+		return specializedNodeUpdateSource(genes, cs, activationFunctionNames, ruleWeights);
+
+	ruleWeights = specializedWeights;
+
+	return specializedSource;
+}
+
+std::string Field2DCL::specializedNodeUpdateSource(Field2DGenes &genes, ComputeSystem &cs, const std::vector<std::string> &activationFunctionNames, std::vector<float> &ruleWeights) {
+	ruleWeights.clear();
 
-		if (std::get<0>(newBounds) > std::get<1>(newBounds))
-			std::get<0>(newBounds) = std::get<1>(newBounds) = (std::get<0>(newBounds) + std::get<1>(newBounds)) * 0.5f;
+	std::string source = field2DGenesNodeUpdateToCL(genes, *this, _connectionPhenotype, _nodePhenotype, activationFunctionNames, _width, _height, _connectionRadius, _numInputs, _numOutputs, _ruleWeightsInBuffer ? &ruleWeights : nullptr);
 
-		genes._recurrentConnectionInitBounds.push_back(newBounds);
+	// Bake the weights into the source if they do not fit in constant memory
+	if (ruleWeights.size() * sizeof(float) > cs.getDevice().getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>()) {
+		ruleWeights.clear();
+
+		source = field2DGenesNodeUpdateToCL(genes, *this, _connectionPhenotype, _nodePhenotype, activationFunctionNames, _width, _height, _connectionRadius, _numInputs, _numOutputs);
 	}
 
+	return source;
+}
+
+std::string Field2DCL::getNodeUpdateSource(Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+	int outputRange, const std::vector<std::string> &activationFunctionNames, Logger &logger)
+{
+	return fieldsNodeUpdateSource(1, genes, cs, width, height, connectionRadius, numInputs, numOutputs, outputRange, activationFunctionNames, logger);
+}
+
+std::string Field2DCL::fieldsNodeUpdateSource(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+	int outputRange, const std::vector<std::string> &activationFunctionNames, Logger &logger)
+{
+	setDimensions(numFields, genes, cs, width, height, connectionRadius, numInputs, numOutputs, outputRange, logger);
+
+	std::vector<float> ruleWeights;
+	std::vector<int> ruleCode;
+
+	return nodeUpdateSource(genes, cs, activationFunctionNames, ruleWeights, ruleCode);
+}
+
+void Field2DCL::createFields(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+	int inputRange, int outputRange,
+	const std::shared_ptr<cl::Image2D> &randomImage,
+	const std::shared_ptr<cl::Program> &gasBlurProgram,
+	const std::shared_ptr<cl::Kernel> &gasBlurKernelX,
+	const std::shared_ptr<cl::Kernel> &gasBlurKernelY,
+	const std::vector<std::function<float(float)>> &activationFunctions, const std::vector<std::string> &activationFunctionNames,
+	float minRecInit, float maxRecInit, std::mt19937 &generator,
+	Logger &logger)
+{
+	_currentReadBufferIndex = 0;
+	_currentWriteBufferIndex = 1;
+
+	_randomImage = randomImage;
+
+	_gasBlurProgram = gasBlurProgram;
+	_gasBlurKernelX = gasBlurKernelX;
+	_gasBlurKernelY = gasBlurKernelY;
+
+	setDimensions(numFields, genes, cs, width, height, connectionRadius, numInputs, numOutputs, outputRange, logger);
+
+	_inputs.clear();
+	_inputs.assign(_numFields * numInputs, 0.0f);
+
+	_outputs.clear();
+	_outputs.assign(_numFields * numOutputs, 0.0f);
+
+	_rewards.clear();
+	_rewards.assign(_numFields, 0.0f);
+
+	std::vector<float> buffer(_bufferSize * _numFields);
+	std::vector<float> recurrentBuffer(_recurrentBufferSize * _numFields);
+
+	// Type phenotype
+	ne::Phenotype typePhenotype;
+
+	typePhenotype.createFromGenotype(genes.getTypeSetGenotype());
+
+	// Create buffer
+	float widthf = static_cast<float>(_width);
+	float heightf = static_cast<float>(_height);
+
+	// Add init bounds for new recurrent data. A no-op when the trainer grew them before evaluating
+	genes.growRecurrentInitBounds(minRecInit, maxRecInit, generator);
+
 	std::vector<float> typeSetRecurrentData(typePhenotype.getRecurrentDataSize(), 0.0f);
 
+	// Types only depend on position, so they are computed once and shared by all fields
+	std::vector<float> nodeTypes(_numNodes * _typeSize);
+
+	std::vector<float> typeInputs(2);
+	std::vector<float> typeOutputs(_typeSize);
+
 	for (int ni = 0; ni < _numNodes; ni++) {
 		int x = ni % _width;
 		int y = ni / _width;
 
-		float xCoord = static_cast<float>(x) / widthf;
-		float yCoord = static_cast<float>(y) / heightf;
+		typeInputs[0] = static_cast<float>(x) / widthf;
+		typeInputs[1] = static_cast<float>(y) / heightf;
 
-		for (int oi = 0; oi < genes.getNodeOutputSize(); oi++)
-			buffer[bufferIndex++] = 0.0f;
+		typePhenotype.execute(typeInputs, typeOutputs, typeSetRecurrentData, activationFunctions);
 
-		std::vector<float> inputs(2);
-		std::vector<float> outputs(_typeSize);
+		for (int ti = 0; ti < _typeSize; ti++)
+			nodeTypes[getTypeIndex(ni, ti)] = typeOutputs[ti];
+	}
 
-		inputs[0] = xCoord;
-		inputs[1] = yCoord;
-		
-		typePhenotype.execute(inputs, outputs, typeSetRecurrentData, activationFunctions);
+	for (int fi = 0; fi < _numFields; fi++)
+	for (int ni = 0; ni < _numNodes; ni++) {
+		int slot = 0;
 
-		for (int ti = 0; ti < _typeSize; ti++)
-			buffer[bufferIndex++] = outputs[ti];
+		for (int oi = 0; oi < genes.getNodeOutputSize(); oi++)
+			buffer[getStateIndex(fi, ni, slot++)] = 0.0f;
+
+		slot = 0;
 
 		// Initialize recurrent data
 		for (int ri = 0; ri < _nodePhenotype.getRecurrentDataSize(); ri++) {
 			std::uniform_real_distribution<float> distInit(std::get<0>(genes._recurrentNodeInitBounds[ri]), std::get<1>(genes._recurrentNodeInitBounds[ri]));
-			buffer[bufferIndex++] = distInit(generator);
+			recurrentBuffer[getRecurrentStateIndex(fi, ni, slot++)] = distInit(generator);
 		}
 
 		// Connections
@@ -135,12 +273,12 @@ void Field2DCL::create(Field2DGenes &genes, ComputeSystem &cs, int width, int he
 			// Initialize recurrent data
 			for (int ri = 0; ri < _connectionPhenotype.getRecurrentDataSize(); ri++) {
 				std::uniform_real_distribution<float> distInit(std::get<0>(genes._recurrentConnectionInitBounds[ri]), std::get<1>(genes._recurrentConnectionInitBounds[ri]));
-				buffer[bufferIndex++] = distInit(generator);
+				recurrentBuffer[getRecurrentStateIndex(fi, ni, slot++)] = distInit(generator);
 			}
 		}
 	}
 
-	// Create type image
+	// Create type image (same IO layout for all fields)
 	struct IOSet {
 		unsigned char _inputIndexPlusOne;
 		unsigned char _outputIndexPlusOne;
@@ -216,169 +354,361 @@ void Field2DCL::create(Field2DGenes &genes, ComputeSystem &cs, int width, int he
 	_buffers[0] = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, buffer.size() * sizeof(float), &buffer[0]);
 	_buffers[1] = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, buffer.size() * sizeof(float), &buffer[0]);
 
-	std::vector<float> gasInit(_numNodes * _numGases, 0.0f);
+	// Types never change, so they are kept once in a read-only buffer
+	if (nodeTypes.empty())
+		nodeTypes.push_back(0.0f); // OpenCL buffers can not be empty
+
+	_nodeTypeBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nodeTypes.size() * sizeof(float), &nodeTypes[0]);
+
+	// Recurrent data is only accessed by the node it belongs to, so it is not double buffered
+	if (recurrentBuffer.empty())
+		recurrentBuffer.push_back(0.0f); // OpenCL buffers can not be empty
+
+	if (_halfPrecisionRecurrents) {
+		std::vector<cl_half> halfRecurrentBuffer(recurrentBuffer.size());
+
+		for (size_t i = 0; i < recurrentBuffer.size(); i++)
+			halfRecurrentBuffer[i] = floatToHalf(recurrentBuffer[i]);
+
+		_recurrentBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, halfRecurrentBuffer.size() * sizeof(cl_half), &halfRecurrentBuffer[0]);
+	}
+	else
+		_recurrentBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, recurrentBuffer.size() * sizeof(float), &recurrentBuffer[0]);
+
+	std::vector<float> gasInit(_numNodes * _numGases * _numFields, 0.0f);
 
 	_gasBuffers[0] = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, gasInit.size() * sizeof(float), &gasInit[0]);
 	_gasBuffers[1] = cl::Buffer(cs.getContext(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, gasInit.size() * sizeof(float), &gasInit[0]);
 	
-	std::vector<float> outputBuffer(getNumOutputs() * _nodeOutputSize * _numOutputsPerBlob, 0.0f);
+	_outputReadBuffer.clear();
+	_outputReadBuffer.assign(_numFields * getNumOutputs() * _nodeOutputSize * _numOutputsPerBlob, 0.0f);
 
-	_outputImage = cl::Image1D(cs.getContext(), CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_R, CL_FLOAT), outputBuffer.size(), &outputBuffer[0]);
+	_outputImage = cl::Image1D(cs.getContext(), CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_R, CL_FLOAT), _outputReadBuffer.size(), &_outputReadBuffer[0]);
 
-	_program = cl::Program(cs.getContext(), field2DGenesNodeUpdateToCL(genes, *this, _connectionPhenotype, _nodePhenotype, activationFunctionNames, _width, _height, _connectionRadius, numInputs, numOutputs));
+	// Persistent input image, rewritten every step from the staging buffer
+	_inputWriteBuffer.clear();
+	_inputWriteBuffer.assign(_numFields * getNumInputs() * _connectionResponseSize, 0.0f);
 
-	if (_program.build(std::vector<cl::Device>(1, cs.getDevice())) != CL_SUCCESS) {
-		logger << "Error building: " << _program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(cs.getDevice()) << erl::endl;
-		abort();
+	_inputImage = cl::Image1D(cs.getContext(), CL_MEM_READ_ONLY, cl::ImageFormat(CL_R, CL_FLOAT), _inputWriteBuffer.size());
+
+	// Per-field rewards
+	_rewardBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY, _numFields * sizeof(float));
+
+	std::vector<float> ruleWeights;
+	std::vector<int> ruleCode;
+
+	// Only generates the specialized source when the rules are not interpreted
+	std::string source = nodeUpdateSource(genes, cs, activationFunctionNames, ruleWeights, ruleCode);
+
+	if (_ruleEvaluation == _interpreted && ruleCode.empty())
+		logger << "Rules can not be interpreted, using specialized rules" + erl::endl;
+
+	// Programs built in a batch have their kernel names suffixed
+	std::string nameSuffix;
+
+	_program = cs.getProgramCache().get(cs.getContext(), cs.getDevice(), source, "", logger, &nameSuffix);
+
+	if (_program == nullptr && !ruleCode.empty()) {
+		logger << "Rule interpreter did not build, using specialized rules" + erl::endl;
+
+		ruleCode.clear();
+
+		source = specializedNodeUpdateSource(genes, cs, activationFunctionNames, ruleWeights);
+
+		_program = cs.getProgramCache().get(cs.getContext(), cs.getDevice(), source, "", logger, &nameSuffix);
 	}
 
+	if (_program == nullptr)
+		abort();
+
+	_interpretRules = !ruleCode.empty();
+
+	// OpenCL buffers can not be empty
+	if (ruleWeights.empty())
+		ruleWeights.push_back(0.0f);
+
+	if (ruleCode.empty())
+		ruleCode.push_back(0);
+
+	_ruleWeightBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ruleWeights.size() * sizeof(float), &ruleWeights[0]);
+	_ruleCodeBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, ruleCode.size() * sizeof(int), &ruleCode[0]);
+
 	//_kernelFunctor = cl::make_kernel<cl::Buffer&, cl::Buffer&, cl::Image2D&, cl::Image1D&, cl::Image1D&, cl::Image2D&, RandomSeed, float>(_program, "nodeUpdate");
 
-	_kernel = cl::Kernel(_program, "nodeUpdate");
+	_kernel = cl::Kernel(*_program, ("nodeUpdate" + nameSuffix).c_str());
 
-	_encoderPhenotypes.resize(numInputs);
-	_decoderPhenotypes.resize(numOutputs);
-	_encoderRecurrentData.resize(numInputs);
-	_decoderRecurrentData.resize(numOutputs);
+	if (_useSubstepKernel) {
+		_substepKernel = cl::Kernel(*_program, ("nodeUpdateSubsteps" + nameSuffix).c_str());
+
+		// The compiled kernel may support smaller work-groups than the device
+		if (_substepKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cs.getDevice()) < static_cast<size_t>(_numNodes))
+			_useSubstepKernel = false;
+	}
+
+	// Blur passes along one axis are linear and wrap, so repeating them is one wrapped convolution with the 9-tap kernel convolved with itself.
+	// The diffusion kernel applies all X passes, then all but the last Y pass (that buffer is the gas source of the next step), then the last Y pass
+	_gasDiffusionPasses = _numGasBlurPasses;
+
+	_useGasDiffusionKernel = _allowGasDiffusionKernel && _numGasBlurPasses > 0 && _numGases > 0 && static_cast<size_t>(_numNodes) <= cs.getDevice().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>() && 2 * _numNodes * sizeof(float) <= cs.getDevice().getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+	if (_useGasDiffusionKernel) {
+		// Same as importances in gasBlur.cl
+		const std::array<double, 9> importances = {
+			0.05, 0.09, 0.12, 0.15, 0.16, 0.15, 0.12, 0.09, 0.05
+		};
+
+		// Weights of a number of passes along an axis of the given size. Node x reads taps from (x + start) % size onwards
+		auto passWeights = [&importances](int passes, int size, int &taps, int &start) {
+			std::vector<double> weights(1, 1.0);
+
+			for (int p = 0; p < passes; p++) {
+				std::vector<double> convolved(weights.size() + importances.size() - 1, 0.0);
+
+				for (size_t i = 0; i < weights.size(); i++)
+					for (size_t j = 0; j < importances.size(); j++)
+						convolved[i + j] += weights[i] * importances[j];
+
+				weights = convolved;
+			}
+
+			int radius = passes * (static_cast<int>(importances.size()) / 2);
+
+			if (static_cast<int>(weights.size()) > size) {
+				// Taps wrap around onto the same nodes, so fold them together
+				std::vector<double> folded(size, 0.0);
+
+				for (int i = 0; i < static_cast<int>(weights.size()); i++)
+					folded[((i - radius) % size + size) % size] += weights[i];
+
+				weights = folded;
+
+				start = 0;
+			}
+			else
+				start = (size - radius % size) % size;
+
+			taps = weights.size();
+
+			return std::vector<float>(weights.begin(), weights.end());
+		};
+
+		std::vector<float> diffusionWeights = passWeights(_numGasBlurPasses, _width, _gasDiffusionTapsX, _gasDiffusionStartX);
+		std::vector<float> diffusionWeightsY = passWeights(_numGasBlurPasses - 1, _height, _gasDiffusionTapsY, _gasDiffusionStartY);
+
+		diffusionWeights.insert(diffusionWeights.end(), diffusionWeightsY.begin(), diffusionWeightsY.end());
+
+		_gasDiffusionWeightBuffer = cl::Buffer(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, diffusionWeights.size() * sizeof(float), &diffusionWeights[0]);
+
+		_gasDiffusionKernel = cl::Kernel(*_gasBlurProgram, "diffuse");
+
+		if (_gasDiffusionKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cs.getDevice()) < static_cast<size_t>(_numNodes))
+			_useGasDiffusionKernel = false;
+	}
 
-	for (int i = 0; i < numInputs; i++) {
+	_encoderPhenotypes.resize(_numFields * numInputs);
+	_decoderPhenotypes.resize(_numFields * numOutputs);
+	_encoderRecurrentData.resize(_numFields * numInputs);
+	_decoderRecurrentData.resize(_numFields * numOutputs);
+
+	for (size_t i = 0; i < _encoderPhenotypes.size(); i++) {
 		_encoderPhenotypes[i].createFromGenotype(genes.getEncoderGenotype());
 
 		_encoderRecurrentData[i].assign(_encoderPhenotypes[i].getRecurrentDataSize(), 0.0f);
 	}
 
-	for (int i = 0; i < numOutputs; i++) {
+	for (size_t i = 0; i < _decoderPhenotypes.size(); i++) {
 		_decoderPhenotypes[i].createFromGenotype(genes.getDecoderGenotype());
 
 		_decoderRecurrentData[i].assign(_decoderPhenotypes[i].getRecurrentDataSize(), 0.0f);
 	}
+
+	// Encoder/decoder I/O scratch, so that update does not allocate
+	_encoderInputs.assign(1, 0.0f);
+	_encoderOutputs.assign(genes.getEncoderGenotype().getNumOutputs(), 0.0f);
+	_decoderInputs.assign(_nodeOutputSize, 0.0f);
+	_decoderOutputs.assign(1, 0.0f);
 }
 
 void Field2DCL::update(float reward, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator) {
-	std::uniform_real_distribution<float> distSeedX(0.0f, static_cast<float>(_width));
-	std::uniform_real_distribution<float> distSeedY(0.0f, static_cast<float>(_height));
-
-	// Create input image
-	std::vector<float> inputBuffer(getNumInputs() * _connectionResponseSize);
-	
-	int inputBufferIndex = 0;
-
-	for (int i = 0; i < getNumInputs(); i++) {
-		std::vector<float> outputBuffer(_encoderPhenotypes[i].getNumOutputs(), 0.0f);
-
-		_encoderPhenotypes[i].execute(std::vector<float>(1, _inputs[i]), outputBuffer, _encoderRecurrentData[i], activationFunctions);
+	beginUpdate(reward, cs, activationFunctions, substeps, generator);
+	endUpdate(activationFunctions);
+}
 
-		for (int j = 0; j < _connectionResponseSize; j++)
-			inputBuffer[inputBufferIndex++] = outputBuffer[j] * _inputStrengthScalar;
-	}
+void Field2DCL::beginUpdate(float reward, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator) {
+	_rewards[0] = reward;
 
- 	_inputImage = cl::Image1D(cs.getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_R, CL_FLOAT), inputBuffer.size(), &inputBuffer[0]);
+	beginUpdateFields(cs, activationFunctions, substeps, generator);
+}
 
-	// Execute kernel
-	//_kernelFunctor(cl::EnqueueArgs(cl::NDRange(_numNodes)), _buffers[_currentReadBufferIndex], _buffers[_currentWriteBufferIndex], _typeImage, _inputImage, _outputImage, *_randomImage, seed, reward).wait();
-	for (int s = 0; s < substeps; s++) {
-		RandomSeed seed;
-		
-		seed._x = distSeedX(generator);
-		seed._y = distSeedY(generator);
+void Field2DCL::endUpdate(const std::vector<std::function<float(float)>> &activationFunctions) {
+	endUpdateFields(activationFunctions);
+}
 
-		_kernel.setArg(0, _buffers[_currentReadBufferIndex]);
-		_kernel.setArg(1, _gasBuffers[_currentReadBufferIndex]);
-		_kernel.setArg(2, _buffers[_currentWriteBufferIndex]);
-		_kernel.setArg(3, _gasBuffers[_currentWriteBufferIndex]);
-		_kernel.setArg(4, _typeImage);
-		_kernel.setArg(5, _inputImage);
-		_kernel.setArg(6, _outputImage);
-		_kernel.setArg(7, *_randomImage);
-		_kernel.setArg(8, seed);
-		_kernel.setArg(9, reward);
+void Field2DCL::beginUpdateFields(ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator) {
+	std::uniform_real_distribution<float> distSeedX(0.0f, static_cast<float>(_width));
+	std::uniform_real_distribution<float> distSeedY(0.0f, static_cast<float>(_height));
 
-		cl::Event event;
+	// Encode inputs into the staging buffer
+	int inputBufferIndex = 0;
 
-		cs.getQueue().enqueueNDRangeKernel(_kernel, cl::NullRange, cl::NDRange(_width, _height), cl::NullRange, nullptr, &event);
+	for (size_t i = 0; i < _encoderPhenotypes.size(); i++) {
+		_encoderInputs[0] = _inputs[i];
 
-		event.wait();
+		_encoderPhenotypes[i].execute(_encoderInputs, _encoderOutputs, _encoderRecurrentData[i], activationFunctions);
 
-		// Swap buffer read/write
-		std::swap(_currentReadBufferIndex, _currentWriteBufferIndex);
+		for (int j = 0; j < _connectionResponseSize; j++)
+			_inputWriteBuffer[inputBufferIndex++] = _encoderOutputs[j] * _inputStrengthScalar;
 	}
 
-	// Gather outputs
+	// Upload to the persistent input image. Non-blocking, the staging buffer is not touched again until endUpdate has synced
 	cl::size_t<3> origin;
 	origin[0] = 0;
 	origin[1] = 0;
 	origin[2] = 0;
 
-	cl::size_t<3> region;
-	region[0] = getNumOutputs() * _nodeOutputSize * _numOutputsPerBlob;
-	region[1] = 1;
-	region[2] = 1;
-
-	std::vector<float> outputBuffer(getNumOutputs() * _nodeOutputSize * _numOutputsPerBlob);
+	cl::size_t<3> inputRegion;
+	inputRegion[0] = _inputWriteBuffer.size();
+	inputRegion[1] = 1;
+	inputRegion[2] = 1;
 
-	cl::Event event;
+	cs.getQueue().enqueueWriteImage(_inputImage, CL_FALSE, origin, inputRegion, 0, 0, &_inputWriteBuffer[0]);
 
-	cs.getQueue().enqueueReadImage(_outputImage, CL_TRUE, origin, region, 0, 0, &outputBuffer[0], nullptr, &event);
+	// The kernels do not use random seeds, but they are still drawn so that the generator sequence stays the same
+	for (int i = 0; i < substeps * _numFields; i++) {
+		distSeedX(generator);
+		distSeedY(generator);
+	}
 
-	event.wait();
+	cs.getQueue().enqueueWriteBuffer(_rewardBuffer, CL_FALSE, 0, _numFields * sizeof(float), &_rewards[0]);
+
+	// Execute kernel. The queue is in-order, so substeps and blur passes are enqueued back to back without host syncs
+	if (_useSubstepKernel && substeps > 1) {
+		_substepKernel.setArg(0, _buffers[_currentReadBufferIndex]);
+		_substepKernel.setArg(1, _gasBuffers[_currentReadBufferIndex]);
+		_substepKernel.setArg(2, _buffers[_currentWriteBufferIndex]);
+		_substepKernel.setArg(3, _gasBuffers[_currentWriteBufferIndex]);
+		_substepKernel.setArg(4, _typeImage);
+		_substepKernel.setArg(5, _inputImage);
+		_substepKernel.setArg(6, _outputImage);
+		_substepKernel.setArg(7, *_randomImage);
+		_substepKernel.setArg(8, substeps);
+		_substepKernel.setArg(9, _rewardBuffer);
+		_substepKernel.setArg(10, _recurrentBuffer);
+		_substepKernel.setArg(11, _nodeTypeBuffer);
+		_substepKernel.setArg(12, _ruleWeightBuffer);
+		_substepKernel.setArg(13, _ruleCodeBuffer);
+
+		// One work-group per field
+		cs.getQueue().enqueueNDRangeKernel(_substepKernel, cl::NullRange, cl::NDRange(_width, _height, _numFields), cl::NDRange(_width, _height, 1));
 
-	// Decode
-	int outputBufferIndex = 0;
+		std::swap(_currentReadBufferIndex, _currentWriteBufferIndex);
+	}
+	else {
+		for (int s = 0; s < substeps; s++) {
+			_kernel.setArg(0, _buffers[_currentReadBufferIndex]);
+			_kernel.setArg(1, _gasBuffers[_currentReadBufferIndex]);
+			_kernel.setArg(2, _buffers[_currentWriteBufferIndex]);
+			_kernel.setArg(3, _gasBuffers[_currentWriteBufferIndex]);
+			_kernel.setArg(4, _typeImage);
+			_kernel.setArg(5, _inputImage);
+			_kernel.setArg(6, _outputImage);
+			_kernel.setArg(7, *_randomImage);
+			_kernel.setArg(8, _rewardBuffer);
+			_kernel.setArg(9, _recurrentBuffer);
+			_kernel.setArg(10, _nodeTypeBuffer);
+			_kernel.setArg(11, _ruleWeightBuffer);
+			_kernel.setArg(12, _ruleCodeBuffer);
+
+			// Third dimension is the field index within the batch
+			cs.getQueue().enqueueNDRangeKernel(_kernel, cl::NullRange, cl::NDRange(_width, _height, _numFields), _tileWidth > 0 ? cl::NDRange(_tileWidth, _tileHeight, 1) : cl::NullRange);
+
+			// Swap buffer read/write
+			std::swap(_currentReadBufferIndex, _currentWriteBufferIndex);
+		}
+	}
 
-	float numOutputsPerBlobInv = 1.0f / _numOutputsPerBlob;
+	// Gather outputs (non-blocking, waited on in endUpdate)
+	cl::size_t<3> outputRegion;
+	outputRegion[0] = _outputReadBuffer.size();
+	outputRegion[1] = 1;
+	outputRegion[2] = 1;
+
+	cs.getQueue().enqueueReadImage(_outputImage, CL_FALSE, origin, outputRegion, 0, 0, &_outputReadBuffer[0], nullptr, &_outputReadEvent);
+
+	// Blur gas. Gas planes of all fields are contiguous, so they are blurred as one stack
+	if (_useGasDiffusionKernel && _numGasBlurPasses == _gasDiffusionPasses) {
+		_gasDiffusionKernel.setArg(0, _gasBuffers[_currentWriteBufferIndex]);
+		_gasDiffusionKernel.setArg(1, _gasBuffers[_currentReadBufferIndex]);
+		_gasDiffusionKernel.setArg(2, getWidth());
+		_gasDiffusionKernel.setArg(3, getHeight());
+		_gasDiffusionKernel.setArg(4, getNumNodes());
+		_gasDiffusionKernel.setArg(5, _gasDiffusionWeightBuffer);
+		_gasDiffusionKernel.setArg(6, _gasDiffusionTapsX);
+		_gasDiffusionKernel.setArg(7, _gasDiffusionStartX);
+		_gasDiffusionKernel.setArg(8, _gasDiffusionTapsY);
+		_gasDiffusionKernel.setArg(9, _gasDiffusionStartY);
+		_gasDiffusionKernel.setArg(10, cl::Local(getNumNodes() * sizeof(float)));
+		_gasDiffusionKernel.setArg(11, cl::Local(getNumNodes() * sizeof(float)));
+
+		// One work-group per gas plane
+		cs.getQueue().enqueueNDRangeKernel(_gasDiffusionKernel, cl::NullRange, cl::NDRange(getWidth(), getHeight(), getNumGases() * _numFields), cl::NDRange(getWidth(), getHeight(), 1));
+	}
+	else {
+		unsigned char _currentBlurReadBufferIndex = _currentWriteBufferIndex;
+		unsigned char _currentBlurWriteBufferIndex = _currentReadBufferIndex;
 
-	for (int i = 0; i < getNumOutputs(); i++) {
-		std::vector<float> decoderInputs(_nodeOutputSize, 0.0f);
+		for (int i = 0; i < _numGasBlurPasses; i++) {
+			{
+				_gasBlurKernelX->setArg(0, _gasBuffers[_currentBlurReadBufferIndex]);
+				_gasBlurKernelX->setArg(1, _gasBuffers[_currentBlurWriteBufferIndex]);
+				_gasBlurKernelX->setArg(2, getWidth());
+				_gasBlurKernelX->setArg(3, getHeight());
+				_gasBlurKernelX->setArg(4, getNumNodes());
 
-		for (int j = 0; j < _numOutputsPerBlob; j++)
-		for (int k = 0; k < _nodeOutputSize; k++)
-			decoderInputs[k] += outputBuffer[outputBufferIndex++];
+				cs.getQueue().enqueueNDRangeKernel(*_gasBlurKernelX, cl::NullRange, cl::NDRange(getWidth(), getHeight(), getNumGases() * _numFields));
 
-		for (int k = 0; k < _nodeOutputSize; k++)
-			decoderInputs[k] *= numOutputsPerBlobInv;
+				std::swap(_currentBlurReadBufferIndex, _currentBlurWriteBufferIndex);
+			}
 
-		std::vector<float> outputBuffer(1, 0.0f);
+			{
+				_gasBlurKernelY->setArg(0, _gasBuffers[_currentBlurReadBufferIndex]);
+				_gasBlurKernelY->setArg(1, _gasBuffers[_currentBlurWriteBufferIndex]);
+				_gasBlurKernelY->setArg(2, getWidth());
+				_gasBlurKernelY->setArg(3, getHeight());
+				_gasBlurKernelY->setArg(4, getNumNodes());
 
-		_decoderPhenotypes[i].execute(decoderInputs, outputBuffer, _decoderRecurrentData[i], activationFunctions);
+				cs.getQueue().enqueueNDRangeKernel(*_gasBlurKernelY, cl::NullRange, cl::NDRange(getWidth(), getHeight(), getNumGases() * _numFields));
 
-		_outputs[i] = outputBuffer[0];
+				std::swap(_currentBlurReadBufferIndex, _currentBlurWriteBufferIndex);
+			}
+		}
 	}
 
-	// Blur gas
-	unsigned char _currentBlurReadBufferIndex = _currentWriteBufferIndex;
-	unsigned char _currentBlurWriteBufferIndex = _currentReadBufferIndex;
-
-	for (int i = 0; i < _numGasBlurPasses; i++) {
-		{
-			_gasBlurKernelX->setArg(0, _gasBuffers[_currentBlurReadBufferIndex]);
-			_gasBlurKernelX->setArg(1, _gasBuffers[_currentBlurWriteBufferIndex]);
-			_gasBlurKernelX->setArg(2, getWidth());
-			_gasBlurKernelX->setArg(3, getHeight());
-			_gasBlurKernelX->setArg(4, getNumNodes());
-
-			cl::Event event;
+	// Start executing while the host does other work
+	cs.getQueue().flush();
+}
 
-			cs.getQueue().enqueueNDRangeKernel(*_gasBlurKernelX, cl::NullRange, cl::NDRange(getWidth(), getHeight(), getNumGases()), cl::NullRange, nullptr, &event);
+void Field2DCL::endUpdateFields(const std::vector<std::function<float(float)>> &activationFunctions) {
+	// Single sync point for the whole step
+	_outputReadEvent.wait();
 
-			event.wait();
+	// Decode
+	int outputBufferIndex = 0;
 
-			std::swap(_currentBlurReadBufferIndex, _currentBlurWriteBufferIndex);
-		}
+	float numOutputsPerBlobInv = 1.0f / _numOutputsPerBlob;
 
-		{
-			_gasBlurKernelY->setArg(0, _gasBuffers[_currentBlurReadBufferIndex]);
-			_gasBlurKernelY->setArg(1, _gasBuffers[_currentBlurWriteBufferIndex]);
-			_gasBlurKernelY->setArg(2, getWidth());
-			_gasBlurKernelY->setArg(3, getHeight());
-			_gasBlurKernelY->setArg(4, getNumNodes());
+	for (size_t i = 0; i < _decoderPhenotypes.size(); i++) {
+		std::fill(_decoderInputs.begin(), _decoderInputs.end(), 0.0f);
 
-			cl::Event event;
+		for (int j = 0; j < _numOutputsPerBlob; j++)
+		for (int k = 0; k < _nodeOutputSize; k++)
+			_decoderInputs[k] += _outputReadBuffer[outputBufferIndex++];
 
-			cs.getQueue().enqueueNDRangeKernel(*_gasBlurKernelY, cl::NullRange, cl::NDRange(getWidth(), getHeight(), getNumGases()), cl::NullRange, nullptr, &event);
+		for (int k = 0; k < _nodeOutputSize; k++)
+			_decoderInputs[k] *= numOutputsPerBlobInv;
 
-			event.wait();
+		_decoderPhenotypes[i].execute(_decoderInputs, _decoderOutputs, _decoderRecurrentData[i], activationFunctions);
 
-			std::swap(_currentBlurReadBufferIndex, _currentBlurWriteBufferIndex);
-		}
+		_outputs[i] = _decoderOutputs[0];
 	}
 }
\ No newline at end of file
@@ -15,6 +15,18 @@ Field2D
 namespace erl {
 	class Field2DCL {
 	public:
+		// Order of the state buffer. AoS keeps all data of a node together (nodeAndConnectionsSize stride),
+		// SoA stores each slot (output channel, type, recurrent, connection recurrent) as a plane of all nodes
+		enum StateLayout {
+			_arrayOfStructures, _structureOfArrays
+		};
+
+		// How the connection and activation rules are evaluated. Specialized generates them as code (fast steps, one build per rule topology),
+		// interpreted runs their bytecode in a program shared by all genotypes (slower steps, no build). Automatic picks based on the expected steps
+		enum RuleEvaluation {
+			_specialized, _interpreted, _automatic
+		};
+
 		struct RandomSeed {
 			float _x, _y;
 
@@ -24,9 +36,10 @@ namespace erl {
 			{}
 		};
 
-	private:
+	protected:
 		std::array<cl::Buffer, 2> _buffers;
 		std::array<cl::Buffer, 2> _gasBuffers;
+		cl::Buffer _recurrentBuffer;
 		//std::function<cl::Event(const cl::EnqueueArgs&, cl::Buffer&, cl::Buffer&, cl::Image2D&, cl::Image1D&, cl::Image1D&, cl::Image2D&, RandomSeed, float)> _kernelFunctor;
 
 		int _numGases;
@@ -35,14 +48,37 @@ namespace erl {
 		unsigned char _currentReadBufferIndex;
 		unsigned char _currentWriteBufferIndex;
 
-		cl::Program _program;
+		// Shared with other fields that generate the same source
+		std::shared_ptr<cl::Program> _program;
 		cl::Kernel _kernel;
 
+		// Runs all substeps in one launch, used when the field fits in one work-group
+		cl::Kernel _substepKernel;
+		bool _useSubstepKernel;
+
 		std::shared_ptr<cl::Program> _gasBlurProgram;
 		std::shared_ptr<cl::Kernel> _gasBlurKernelX;
 		std::shared_ptr<cl::Kernel> _gasBlurKernelY;
 
+		// Runs all gas blur passes in one launch, used when a gas plane fits in one work-group.
+		// The weight buffer holds the X passes and all but the last Y pass, each combined into one wrapped kernel
+		cl::Kernel _gasDiffusionKernel;
+		cl::Buffer _gasDiffusionWeightBuffer;
+		bool _useGasDiffusionKernel;
+		int _gasDiffusionPasses;
+		int _gasDiffusionTapsX, _gasDiffusionStartX;
+		int _gasDiffusionTapsY, _gasDiffusionStartY;
+
+		// Static per-node data. Input/output indices, and node types from the type set phenotype
 		cl::Image2D _typeImage;
+		cl::Buffer _nodeTypeBuffer;
+
+		// Strength scalars and rule weights, when they are not baked into the program
+		cl::Buffer _ruleWeightBuffer;
+
+		// Rule bytecode, when the rules are interpreted
+		cl::Buffer _ruleCodeBuffer;
+		bool _interpretRules;
 
 		cl::Image1D _inputImage;
 		cl::Image1D _outputImage;
@@ -66,7 +102,31 @@ namespace erl {
 
 		int _numNodes;
 
+		// Per node, outputs read by neighbours (double buffered) and recurrent data only used by the node itself (updated in place)
+		int _nodeStateSize;
+		int _recurrentStateSize;
+
 		int _bufferSize;
+		int _recurrentBufferSize;
+
+		// Distance between neighbouring nodes in the node state, recurrent state and node types, and between neighbouring slots of a node in any of them
+		int _nodeStride;
+		int _recurrentNodeStride;
+		int _typeNodeStride;
+		int _slotStride;
+
+		// Whether the generated connection loop is unrolled with compile-time offsets
+		bool _unrollConnections;
+
+		// Work-group tile used by the tiled neighbourhood gather, 0 when not tiled
+		int _tileWidth;
+		int _tileHeight;
+
+		// Number of fields packed into the buffers (1 unless created through Field2DBatch)
+		int _numFields;
+
+		int _numInputs;
+		int _numOutputs;
 
 		int _numOutputsPerBlob;
 
@@ -74,9 +134,53 @@ namespace erl {
 		float _nodeOutputStrengthScalar;
 		float _connectionStrengthScalar;
 
+		// Inputs and outputs of all fields, field-major
 		std::vector<float> _inputs;
 		std::vector<float> _outputs;
 
+		// Per-field step parameters
+		std::vector<float> _rewards;
+		cl::Buffer _rewardBuffer;
+
+		std::vector<float> _inputWriteBuffer;
+		std::vector<float> _outputReadBuffer;
+		cl::Event _outputReadEvent;
+
+		std::vector<float> _encoderInputs;
+		std::vector<float> _encoderOutputs;
+		std::vector<float> _decoderInputs;
+		std::vector<float> _decoderOutputs;
+
+		// Sizes, strides, tiling and kernel choice, everything the generated source depends on
+		void setDimensions(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+			int outputRange, Logger &logger);
+
+		// Node update source for the current dimensions, interpreted if the rule evaluation setting picks it and it is possible, specialized otherwise.
+		// Automatic evaluation generates the specialized source to look it up in the program cache.
+		// Fills ruleWeights when they are passed in a buffer, and ruleCode when the rules are interpreted
+		std::string nodeUpdateSource(Field2DGenes &genes, ComputeSystem &cs, const std::vector<std::string> &activationFunctionNames, std::vector<float> &ruleWeights, std::vector<int> &ruleCode);
+
+		// Specialized node update source for the current dimensions. Fills ruleWeights when they are passed in a buffer
+		std::string specializedNodeUpdateSource(Field2DGenes &genes, ComputeSystem &cs, const std::vector<std::string> &activationFunctionNames, std::vector<float> &ruleWeights);
+
+		// getNodeUpdateSource for numFields fields sharing the program
+		std::string fieldsNodeUpdateSource(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+			int outputRange, const std::vector<std::string> &activationFunctionNames, Logger &logger);
+
+		void createFields(int numFields, Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+			int inputRange, int outputRange,
+			const std::shared_ptr<cl::Image2D> &randomImage,
+			const std::shared_ptr<cl::Program> &gasBlurProgram,
+			const std::shared_ptr<cl::Kernel> &gasBlurKernelX,
+			const std::shared_ptr<cl::Kernel> &gasBlurKernelY,
+			const std::vector<std::function<float(float)>> &activationFunctions, const std::vector<std::string> &activationFunctionNames,
+			float minRecInit, float maxRecInit, std::mt19937 &generator,
+			Logger &logger);
+
+		// Step all fields using the rewards in _rewards
+		void beginUpdateFields(ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator);
+		void endUpdateFields(const std::vector<std::function<float(float)>> &activationFunctions);
+
 		std::vector<ne::Phenotype> _encoderPhenotypes;
 		std::vector<ne::Phenotype> _decoderPhenotypes;
 		std::vector<std::vector<float>> _encoderRecurrentData;
@@ -85,6 +189,39 @@ namespace erl {
 	public:
 		int _numGasBlurPasses;
 
+		// Set before create
+		StateLayout _stateLayout;
+
+		// Maximum work-group tile dimension for gathering neighbours through local memory, 0 to read them directly from global memory. Set before create
+		int _gatherTileSize;
+
+		// Allow running all substeps in a single launch when the field fits in one work-group. Set before create
+		bool _allowSubstepKernel;
+
+		// Allow running all gas blur passes in a single launch when a gas plane fits in one work-group. Set before create
+		bool _allowGasDiffusionKernel;
+
+		// Pass strength scalars and rule weights in a constant buffer instead of baking them into the source,
+		// so genotypes that only differ in weights share a program. Set before create
+		bool _ruleWeightsInBuffer;
+
+		// Store recurrent state as fp16 to halve its memory traffic, arithmetic stays fp32. Set before create
+		bool _halfPrecisionRecurrents;
+
+		// Unroll the connection loop with compile-time offsets when a node has at most this many connections, 0 to always loop. Set before create
+		int _maxUnrolledConnections;
+
+		// Set before create
+		RuleEvaluation _ruleEvaluation;
+
+		// Expected number of node update substeps over the life of each field, 0 if unknown. Automatic rule evaluation interprets the rules when
+		// this times the number of fields sharing the program is below _interpreterBreakEvenSteps, and the specialized program is not cached. Set before create
+		int _expectedSteps;
+
+		// Substeps after which building the specialized program pays off: its build time over the time per substep the interpreter loses.
+		// Depends on the device and driver and has not been measured, so it is 0 and automatic evaluation always specializes until it is set. Set before create
+		int _interpreterBreakEvenSteps;
+
 		Field2DCL();
 
 		void create(Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
@@ -97,8 +234,17 @@ namespace erl {
 			float minRecInit, float maxRecInit, std::mt19937 &generator,
 			Logger &logger);
 
+		// Source of the node update program create would build with the same arguments and options, without creating the field.
+		// Lets a trainer build the programs of many fields in one batch before creating them
+		std::string getNodeUpdateSource(Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+			int outputRange, const std::vector<std::string> &activationFunctionNames, Logger &logger);
+
 		void update(float reward, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator);
 
+		// Split version of update. beginUpdate enqueues all substeps and blur passes without blocking, endUpdate waits once and decodes the outputs
+		void beginUpdate(float reward, ComputeSystem &cs, const std::vector<std::function<float(float)>> &activationFunctions, int substeps, std::mt19937 &generator);
+		void endUpdate(const std::vector<std::function<float(float)>> &activationFunctions);
+
 		int getConnectionResponseSize() const {
 			return _connectionResponseSize;
 		}
@@ -151,16 +297,91 @@ namespace erl {
 			return _numNodes;
 		}
 
+		int getNodeStateSize() const {
+			return _nodeStateSize;
+		}
+
+		int getRecurrentStateSize() const {
+			return _recurrentStateSize;
+		}
+
 		int getBufferSize() const {
 			return _bufferSize;
 		}
 
+		int getRecurrentBufferSize() const {
+			return _recurrentBufferSize;
+		}
+
+		int getNodeStride() const {
+			return _nodeStride;
+		}
+
+		int getRecurrentNodeStride() const {
+			return _recurrentNodeStride;
+		}
+
+		int getTypeNodeStride() const {
+			return _typeNodeStride;
+		}
+
+		int getSlotStride() const {
+			return _slotStride;
+		}
+
+		int getTileWidth() const {
+			return _tileWidth;
+		}
+
+		int getTileHeight() const {
+			return _tileHeight;
+		}
+
+		bool getUnrollConnections() const {
+			return _unrollConnections;
+		}
+
+		bool getUseSubstepKernel() const {
+			return _useSubstepKernel;
+		}
+
+		bool getUseGasDiffusionKernel() const {
+			return _useGasDiffusionKernel;
+		}
+
+		bool getHalfPrecisionRecurrents() const {
+			return _halfPrecisionRecurrents;
+		}
+
+		bool getInterpretRules() const {
+			return _interpretRules;
+		}
+
+		// Index of a slot of a node in the node state buffers
+		int getStateIndex(int fieldIndex, int nodeIndex, int slot) const {
+			return fieldIndex * _bufferSize + nodeIndex * _nodeStride + slot * _slotStride;
+		}
+
+		// Index of a type of a node in the node type buffer
+		int getTypeIndex(int nodeIndex, int slot) const {
+			return nodeIndex * _typeNodeStride + slot * _slotStride;
+		}
+
+		// Index of a slot of a node in the recurrent state buffer
+		int getRecurrentStateIndex(int fieldIndex, int nodeIndex, int slot) const {
+			return fieldIndex * _recurrentBufferSize + nodeIndex * _recurrentNodeStride + slot * _slotStride;
+		}
+
 		int getNumInputs() const {
-			return _inputs.size();
+			return _numInputs;
 		}
 
 		int getNumOutputs() const {
-			return _outputs.size();
+			return _numOutputs;
+		}
+
+		int getNumFields() const {
+			return _numFields;
 		}
 
 		int getNumOutputsPerBlob() const {
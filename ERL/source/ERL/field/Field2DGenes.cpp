@@ -1,5 +1,7 @@
 #include <erl/field/Field2DGenes.h>
 
+#include <ne/Phenotype.h>
+
 #include <algorithm>
 
 using namespace erl;
@@ -176,6 +178,34 @@ void Field2DGenes::mutate(const Field2DEvolverSettings* pSettings, const std::ve
 	}
 }
 
+void Field2DGenes::growRecurrentInitBounds(float minRecInit, float maxRecInit, std::mt19937 &generator) {
+	ne::Phenotype nodePhenotype;
+	ne::Phenotype connectionPhenotype;
+
+	nodePhenotype.createFromGenotype(_activationUpdateGenotype);
+	connectionPhenotype.createFromGenotype(_connectionUpdateGenotype);
+
+	std::uniform_real_distribution<float> distRecInit(minRecInit, maxRecInit);
+
+	while (_recurrentNodeInitBounds.size() < nodePhenotype.getRecurrentDataSize()) {
+		std::tuple<float, float> newBounds = std::make_tuple<float, float>(distRecInit(generator), distRecInit(generator));
+
+		if (std::get<0>(newBounds) > std::get<1>(newBounds))
+			std::get<0>(newBounds) = std::get<1>(newBounds) = (std::get<0>(newBounds) + std::get<1>(newBounds)) * 0.5f;
+
+		_recurrentNodeInitBounds.push_back(newBounds);
+	}
+
+	while (_recurrentConnectionInitBounds.size() < connectionPhenotype.getRecurrentDataSize()) {
+		std::tuple<float, float> newBounds = std::make_tuple<float, float>(distRecInit(generator), distRecInit(generator));
+
+		if (std::get<0>(newBounds) > std::get<1>(newBounds))
+			std::get<0>(newBounds) = std::get<1>(newBounds) = (std::get<0>(newBounds) + std::get<1>(newBounds)) * 0.5f;
+
+		_recurrentConnectionInitBounds.push_back(newBounds);
+	}
+}
+
 float Field2DGenes::getSimilarity(const Field2DEvolverSettings* pSettings, const std::vector<float> &functionChances, const Field2DGenes* pGenotype1, const Field2DGenes* pGenotype2, const std::unordered_map<ne::Genotype::FunctionPair, float, ne::Genotype::FunctionPair> &functionFactors) {
 	const Field2DEvolverSettings* pF2DSettings = static_cast<const Field2DEvolverSettings*>(pSettings);
 
@@ -36,6 +36,10 @@ namespace erl {
 		void initialize(const Field2DEvolverSettings* pSettings, const std::vector<float> &functionChances, std::mt19937 &generator);
 		void crossover(const Field2DEvolverSettings* pSettings, const std::vector<float> &functionChances, const Field2DGenes* pParent1, const Field2DGenes* pParent2, std::mt19937 &generator);
 		void mutate(const Field2DEvolverSettings* pSettings, const std::vector<float> &functionChances, std::mt19937 &generator);
+
+		// Add init bounds for recurrent data the rules gained since the bounds were last grown. Fields only read the bounds after this,
+		// so fields of the same genes can then be created concurrently
+		void growRecurrentInitBounds(float minRecInit, float maxRecInit, std::mt19937 &generator);
 		
 		static float getSimilarity(const Field2DEvolverSettings* pSettings, const std::vector<float> &functionChances, const Field2DGenes* pGenotype1, const Field2DGenes* pGenotype2, const std::unordered_map<ne::Genotype::FunctionPair, float, ne::Genotype::FunctionPair> &functionFactors);
 
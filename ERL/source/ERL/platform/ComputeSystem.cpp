@@ -70,4 +70,14 @@ void ComputeSystem::create(DeviceType type, Logger &logger) {
 	_context = _device;
 
 	_queue = cl::CommandQueue(_context, _device);
+}
+
+void ComputeSystem::createShared(ComputeSystem &other) {
+	_platform = other._platform;
+	_device = other._device;
+	_context = other._context;
+
+	_queue = cl::CommandQueue(_context, _device);
+
+	_pProgramCache = other._pProgramCache;
 }
\ No newline at end of file
@@ -8,6 +8,7 @@ Platform
 
 #include <erl/platform/Logger.h>
 #include <erl/platform/Uncopyable.h>
+#include <erl/platform/ProgramCache.h>
 #include <CL/cl.hpp>
 
 namespace erl {
@@ -23,10 +24,23 @@ namespace erl {
 		cl::Context _context;
 		cl::CommandQueue _queue;
 
+		ProgramCache _programCache;
+
+		// Own cache, or the cache of the compute system this one shares a context with
+		ProgramCache* _pProgramCache;
+
 	public:
+		ComputeSystem()
+			: _pProgramCache(&_programCache)
+		{}
+
 		void create(DeviceType type);
 		void create(DeviceType type, Logger &logger);
 
+		// Use the platform, device, context and program cache of another compute system, with a command queue of its own.
+		// Lets several threads use the device at once, the other compute system must outlive this one
+		void createShared(ComputeSystem &other);
+
 		cl::Platform &getPlatform() {
 			return _platform;
 		}
@@ -42,5 +56,9 @@ namespace erl {
 		cl::CommandQueue &getQueue() {
 			return _queue;
 		}
+
+		ProgramCache &getProgramCache() {
+			return *_pProgramCache;
+		}
 	};
 }
\ No newline at end of file
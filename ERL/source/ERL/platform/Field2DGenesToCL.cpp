@@ -1,17 +1,170 @@
 #include <erl/platform/Field2DGenesToCL.h>
 #include <erl/platform/RuleToCL.h>
+#include <erl/platform/ProgramCache.h>
 
 using namespace erl;
 
-// Buffer is organized like so:
-// nodeOutput[0..n] + typeInput + nodeRecurrentData[0..n] + c * (connectionResponse[0..n] + typeInput + connectionRecurrentData[0..n])
+// Node state (read by neighbours, double buffered) is organized like so:
+// nodeOutput[0..n]
+// Node types (static, shared by all fields) are organized like so:
+// typeInput[0..n]
+// Recurrent state (only used by the node itself, updated in place) is organized like so:
+// nodeRecurrentData[0..n] + c * connectionRecurrentData[0..n]
+// Batched fields (global id 2) follow each other in the node and recurrent state, fieldArea nodes per field. Gas, input and output data are laid out per field in the same way
+// With the SoA state layout, slot k of a node is at nodeIndex + k * fieldArea within its field instead of nodeIndex * stateSize + k
 
 std::string erl::field2DGenesNodeUpdateToCL(erl::Field2DGenes &genes, const erl::Field2DCL &field,
 	ne::Phenotype &connectionPhenotype, ne::Phenotype &nodePhenotype,
-	const std::vector<std::string> &functionNames, int fieldWidth, int fieldHeight, int connectionRadius, int numInputs, int numOutputs)
+	const std::vector<std::string> &functionNames, int fieldWidth, int fieldHeight, int connectionRadius, int numInputs, int numOutputs,
+	std::vector<float>* pRuleWeights, std::vector<int>* pRuleCode)
 {
 	std::string code = "";
 
+	// Names declared at program scope, suffixed when the source is built in a batch
+	std::vector<std::string> programScopeNames = {
+		"unnormalizedClampedNearestSampler", "normalizedRepeatNearestSampler",
+		"fieldWidth", "fieldHeight", "fieldArea", "fieldWidthInv", "fieldHeightInv",
+		"numInputs", "numOutputs", "inputsPerField", "outputsPerField", "randomImageSizeInv", "offsets",
+		"sigmoid", "linear", "scaledSigmoid",
+		"connectionRule", "activationRule",
+		"nodeStateSize", "recurrentStateSize", "connectionSize", "nodeRecurrentSize", "numConnections", "numGases",
+		"typeSize", "typeNodeStride", "nodeStride", "recurrentNodeStride", "slotStride",
+		"nodeUpdate"
+	};
+
+	// Offset of a slot relative to the start of a node
+	auto slotOffset = [&field](int slot) {
+		return std::to_string(slot * field.getSlotStride());
+	};
+
+	// Recurrent state is stored as fp16 when the field was created with half precision recurrents, arithmetic stays fp32
+	bool halfRecurrents = field.getHalfPrecisionRecurrents();
+
+	std::string recurrentType = halfRecurrents ? "half" : "float";
+
+	auto loadRecurrent = [halfRecurrents](const std::string &index) {
+		if (halfRecurrents)
+			return "vload_half(" + index + ", recurrent)";
+
+		return "recurrent[" + index + "]";
+	};
+
+	auto storeRecurrent = [halfRecurrents](const std::string &index, const std::string &value) {
+		if (halfRecurrents)
+			return "vstore_half(" + value + ", " + index + ", recurrent);\n";
+
+		return "recurrent[" + index + "] = " + value + ";\n";
+	};
+
+	// Multi-channel values are packed into float2, float4 or float8 when there are that many, otherwise they stay scalars
+	auto vectorWidth = [](int n) {
+		return n == 2 || n == 4 || n == 8 ? n : 0;
+	};
+
+	auto vectorType = [](int n) {
+		return "float" + std::to_string(n);
+	};
+
+	// Packs scalars name0..name(n - 1)
+	auto vectorOf = [&vectorType](const std::string &name, int n) {
+		std::string vector = "(" + vectorType(n) + ")(";
+
+		for (int i = 0; i < n; i++)
+			vector += (i > 0 ? ", " : "") + name + std::to_string(i);
+
+		return vector + ")";
+	};
+
+	// Slots of a node are only contiguous in the AoS layout, where one vector load or store can move them
+	bool contiguousSlots = field.getSlotStride() == 1;
+
+	auto loadRecurrentVector = [halfRecurrents](const std::string &index, int n) {
+		if (halfRecurrents)
+			return "vload_half" + std::to_string(n) + "(0, recurrent + " + index + ")";
+
+		return "vload" + std::to_string(n) + "(0, recurrent + " + index + ")";
+	};
+
+	auto storeRecurrentVector = [halfRecurrents](const std::string &index, const std::string &value, int n) {
+		if (halfRecurrents)
+			return "vstore_half" + std::to_string(n) + "(" + value + ", 0, recurrent + " + index + ");\n";
+
+		return "vstore" + std::to_string(n) + "(" + value + ", 0, recurrent + " + index + ");\n";
+	};
+
+	// Loads n contiguous recurrent slots into scalars name0..name(n - 1), through one vector when possible
+	auto loadRecurrentsToCL = [&](const std::string &name, const std::string &startOffset, int n) {
+		std::string load = "";
+
+		if (contiguousSlots && vectorWidth(n) > 0) {
+			load += vectorType(n) + " " + name + "s = " + loadRecurrentVector(startOffset, n) + ";\n";
+
+			for (int i = 0; i < n; i++)
+				load += "float " + name + std::to_string(i) + " = " + name + "s.s" + std::to_string(i) + ";\n";
+		}
+		else {
+			for (int i = 0; i < n; i++)
+				load += "float " + name + std::to_string(i) + " = " + loadRecurrent(startOffset + " + " + slotOffset(i)) + ";\n";
+		}
+
+		return load;
+	};
+
+	auto storeRecurrentsToCL = [&](const std::string &name, const std::string &startOffset, int n) {
+		std::string store = "";
+
+		if (contiguousSlots && vectorWidth(n) > 0)
+			store += storeRecurrentVector(startOffset, vectorOf(name, n), n);
+		else {
+			for (int i = 0; i < n; i++)
+				store += storeRecurrent(startOffset + " + " + slotOffset(i), name + std::to_string(i));
+		}
+
+		return store;
+	};
+
+	// Neighbour outputs and types are gathered through local memory if the field was created with a tile size
+	bool tiled = field.getTileWidth() > 0;
+
+	int tileSlots = genes.getNodeOutputSize() + genes.getTypeSize();
+
+	// Rule inputs that reach an output or recurrent. Unused inputs are passed as 0 and their loads are left out.
+	// Interpreted rules can read any input, and their source may not depend on the genotype
+	std::vector<bool> connectionInputsUsed(connectionPhenotype.getNumInputs(), true);
+	std::vector<bool> nodeInputsUsed(nodePhenotype.getNumInputs(), true);
+
+	if (pRuleCode == nullptr) {
+		connectionInputsUsed = getRuleInputsUsed(connectionPhenotype, pRuleWeights != nullptr);
+		nodeInputsUsed = getRuleInputsUsed(nodePhenotype, pRuleWeights != nullptr);
+	}
+
+	// Connection rule inputs are neighbour outputs, node types, neighbour types, offset x and y, random and reward.
+	// Activation rule inputs are response sums, gases, node types, random and reward
+	int connectionTypeInputsStart = genes.getNodeOutputSize();
+	int connectionNodeTypeInputsStart = connectionTypeInputsStart + genes.getTypeSize();
+	int connectionOffsetInputsStart = connectionNodeTypeInputsStart + genes.getTypeSize();
+	int nodeGasInputsStart = genes.getConnectionResponseSize();
+	int nodeTypeInputsStart = nodeGasInputsStart + genes.getNumGases();
+	int nodeRandomInputIndex = nodeTypeInputsStart + genes.getTypeSize();
+
+	auto connectionInput = [&connectionInputsUsed](int index, const std::string &value) {
+		return connectionInputsUsed[index] ? value : std::string("0.0f");
+	};
+
+	auto nodeInput = [&nodeInputsUsed](int index, const std::string &value) {
+		return nodeInputsUsed[index] ? value : std::string("0.0f");
+	};
+
+	auto nodeTypeUsed = [&](int i) {
+		return connectionInputsUsed[connectionTypeInputsStart + i] || nodeInputsUsed[nodeTypeInputsStart + i];
+	};
+
+	auto connectionNodeTypeUsed = [&](int i) {
+		return connectionInputsUsed[connectionNodeTypeInputsStart + i];
+	};
+
+	bool rewardUsed = connectionInputsUsed[connectionOffsetInputsStart + 3] || nodeInputsUsed[nodeRandomInputIndex + 1];
+
 	// Add header
 	code +=
 		"/*\n"
@@ -34,11 +187,34 @@ std::string erl::field2DGenesNodeUpdateToCL(erl::Field2DGenes &genes, const erl:
 		"constant int fieldHeight = " + std::to_string(fieldHeight) + ";\n"
 		"constant int fieldArea = " + std::to_string(fieldWidth * fieldHeight) + ";\n"
 		"constant float fieldWidthInv = " + std::to_string(1.0f / fieldWidth) + "f;\n"
-		"constant float fieldHeightInv = " + std::to_string(1.0f / fieldHeight) + "f;\n"
-		"constant float connectionStrengthScalar = " + std::to_string(field.getConnectionStrengthScalar()) + "f;\n"
-		"constant float nodeOutputStrengthScalar = " + std::to_string(field.getNodeOutputStrengthScalar()) + "f;\n"
+		"constant float fieldHeightInv = " + std::to_string(1.0f / fieldHeight) + "f;\n";
+
+	// Strength scalars are the first rule weights when weights are not baked into the source
+	std::string strengthScalarsToCL;
+
+	if (pRuleWeights == nullptr) {
+		code +=
+			"constant float connectionStrengthScalar = " + std::to_string(field.getConnectionStrengthScalar()) + "f;\n"
+			"constant float nodeOutputStrengthScalar = " + std::to_string(field.getNodeOutputStrengthScalar()) + "f;\n";
+
+		programScopeNames.push_back("connectionStrengthScalar");
+		programScopeNames.push_back("nodeOutputStrengthScalar");
+	}
+	else {
+		pRuleWeights->clear();
+		pRuleWeights->push_back(field.getConnectionStrengthScalar());
+		pRuleWeights->push_back(field.getNodeOutputStrengthScalar());
+
+		strengthScalarsToCL =
+			"	float connectionStrengthScalar = ruleWeights[0];\n"
+			"	float nodeOutputStrengthScalar = ruleWeights[1];\n";
+	}
+
+	code +=
 		"constant int numInputs = " + std::to_string(numInputs) + ";\n"
 		"constant int numOutputs = " + std::to_string(numOutputs) + ";\n"
+		"constant int inputsPerField = " + std::to_string(numInputs * genes.getConnectionResponseSize()) + ";\n"
+		"constant int outputsPerField = " + std::to_string(numOutputs * field.getNumOutputsPerBlob() * genes.getNodeOutputSize()) + ";\n"
 		"constant float randomImageSizeInv = 0.0078125f;\n"
 		"\n"
 		"// Connection offsets\n"
@@ -76,260 +252,716 @@ std::string erl::field2DGenesNodeUpdateToCL(erl::Field2DGenes &genes, const erl:
 		"float scaledSigmoid(float x) {\n"
 		"	return 2.0f / (1.0f + exp(-x)) - 1.0f;\n"
 		"}\n"
-		"\n"
-		"// Connection update rule\n";
+		"\n";
 
 	// Generate rules for all nets
-	code += ruleToCL(connectionPhenotype, "connectionRule", functionNames);
+	if (pRuleCode != nullptr) {
+		// Start of the connection and activation rules, followed by their bytecode
+		pRuleCode->assign(2, 0);
+
+		(*pRuleCode)[0] = pRuleCode->size();
+
+		bool interpretable = ruleToBytecode(connectionPhenotype, *pRuleCode, *pRuleWeights);
+
+		(*pRuleCode)[1] = pRuleCode->size();
+
+		interpretable = ruleToBytecode(nodePhenotype, *pRuleCode, *pRuleWeights) && interpretable;
+
+		if (!interpretable) {
+			pRuleCode->clear();
+
+			return "";
+		}
+
+		code += "// Rule bytecode interpreter\n";
+
+		code += ruleInterpreterToCL(functionNames);
+
+		programScopeNames.push_back("applyRuleFunction");
+		programScopeNames.push_back("interpretRule");
+
+		code += "\n// Connection update rule\n";
 
-	code += "\n// Activation update rule\n";
+		code += ruleWrapperToCL(connectionPhenotype, "connectionRule", 0);
 
-	code += ruleToCL(nodePhenotype, "activationRule", functionNames);
+		code += "\n// Activation update rule\n";
+
+		code += ruleWrapperToCL(nodePhenotype, "activationRule", 1);
+	}
+	else {
+		code += "// Connection update rule\n";
+
+		code += ruleToCL(connectionPhenotype, "connectionRule", functionNames, pRuleWeights);
+
+		code += "\n// Activation update rule\n";
+
+		code += ruleToCL(nodePhenotype, "activationRule", functionNames, pRuleWeights);
+	}
 
 	// Other constants, and kernel definition
 	code +=
 		"\n"
 		"// Data sizes\n"
-		"constant int nodeAndConnectionsSize = " + std::to_string(field.getNodeAndConnectionsSize()) + ";\n"
+		"constant int nodeStateSize = " + std::to_string(field.getNodeStateSize()) + ";\n"
+		"constant int recurrentStateSize = " + std::to_string(field.getRecurrentStateSize()) + ";\n"
 		"constant int connectionSize = " + std::to_string(field.getConnectionSize()) + ";\n"
-		"constant int nodeSize = " + std::to_string(field.getNodeSize()) + ";\n"
+		"constant int nodeRecurrentSize = " + std::to_string(nodePhenotype.getRecurrentDataSize()) + ";\n"
 		"constant int numConnections = " + std::to_string(field.getNumConnections()) + ";\n"
 		"constant int numGases = " + std::to_string(field.getNumGases()) + ";\n"
 		"constant int typeSize = " + std::to_string(field.getTypeSize()) + ";\n"
-		"\n"
-		"// The kernel\n"
-		"void kernel nodeUpdate(global const float* source, global const float* gasSource, global float* destination, global float* gasDestination, read_only image2d_t typeImage, read_only image1d_t inputImage, write_only image1d_t outputImage, read_only image2d_t randomImage, float2 randomSeed, float reward) {\n"
-		"	int2 nodePosition = (int2)(get_global_id(0), get_global_id(1));\n"
-		"	int nodeIndex = nodePosition.x + nodePosition.y * fieldWidth;\n"
-		"	int nodeStartOffset = nodeIndex * nodeAndConnectionsSize;\n"
-		"	int connectionsStartOffset = nodeStartOffset + nodeSize;\n"
-		"	float2 normalizedCoords = ((float2)(nodePosition.x, nodePosition.y)) * ((float2)(fieldWidthInv, fieldHeightInv));\n";
-
-	for (int i = 0; i < genes.getTypeSize(); i++) {
-		code +=	"	float nodeType" + std::to_string(i) + " = source[nodeStartOffset + " + std::to_string(genes.getNodeOutputSize() + i) + "];\n";
+		"constant int typeNodeStride = " + std::to_string(field.getTypeNodeStride()) + ";\n"
+		"constant int nodeStride = " + std::to_string(field.getNodeStride()) + ";\n"
+		"constant int recurrentNodeStride = " + std::to_string(field.getRecurrentNodeStride()) + ";\n"
+		"constant int slotStride = " + std::to_string(field.getSlotStride()) + ";\n";
+
+	if (tiled) {
+		code +=
+			"\n"
+			"// Work-group tile with a halo of connectionRadius nodes\n"
+			"constant int connectionRadius = " + std::to_string(connectionRadius) + ";\n"
+			"constant int tileWidth = " + std::to_string(field.getTileWidth()) + ";\n"
+			"constant int tileHeight = " + std::to_string(field.getTileHeight()) + ";\n"
+			"constant int tileHaloWidth = " + std::to_string(field.getTileWidth() + 2 * connectionRadius) + ";\n"
+			"constant int tileHaloArea = " + std::to_string((field.getTileWidth() + 2 * connectionRadius) * (field.getTileHeight() + 2 * connectionRadius)) + ";\n";
+
+		programScopeNames.insert(programScopeNames.end(), { "connectionRadius", "tileWidth", "tileHeight", "tileHaloWidth", "tileHaloArea" });
 	}
 
+	// Adds one level of indentation to a block of code
+	auto indent = [](const std::string &block) {
+		std::string indented = "";
+
+		bool lineStart = true;
+
+		for (char c : block) {
+			if (lineStart && c != '\n')
+				indented += '\t';
+
+			indented += c;
+
+			lineStart = c == '\n';
+		}
+
+		return indented;
+	};
+
+	// Per-substep part of the kernels, from gathering connections to the activation rule.
+	// Inside the substep loop of nodeUpdateSubsteps, neighbours come from the local copy of the field and node state is declared outside the loop
+	auto stepToCL = [&](bool substepLoop) {
+		std::string step = "";
+
+		// Where neighbour slot i is read from
+		std::function<std::string(int)> neighbourSlot;
+
+		// Neighbour outputs read from global memory are fetched with one vector load, when at least two of them are used
+		int numNeighbourOutputsUsed = 0;
+
+		for (int i = 0; i < genes.getNodeOutputSize(); i++)
+		if (connectionInputsUsed[i])
+			numNeighbourOutputsUsed++;
+
+		bool vectorNeighbourOutputs = !substepLoop && !tiled && contiguousSlots && vectorWidth(genes.getNodeOutputSize()) > 0 && numNeighbourOutputsUsed >= 2;
+
+		if (substepLoop) {
+			neighbourSlot = [&genes](int slot) {
+				if (slot < genes.getNodeOutputSize())
+					return "fieldOutputs[readOffset + connectionNodeIndex + " + std::to_string(slot) + " * fieldArea]";
+
+				return "fieldTypes[connectionNodeIndex + " + std::to_string(slot - genes.getNodeOutputSize()) + " * fieldArea]";
+			};
+		}
+		else if (tiled) {
+			neighbourSlot = [](int slot) {
+				return "tile[tileIndex + " + std::to_string(slot) + " * tileHaloArea]";
+			};
+		}
+		else {
+			neighbourSlot = [&genes, &slotOffset, vectorNeighbourOutputs](int slot) {
+				if (slot < genes.getNodeOutputSize())
+					return vectorNeighbourOutputs ? "connectionNodeOutputs.s" + std::to_string(slot) : "source[connectionNodeStartOffset + " + slotOffset(slot) + "]";
+
+				return "nodeTypes[connectionNodeIndex * typeNodeStride + " + slotOffset(slot - genes.getNodeOutputSize()) + "]";
+			};
+		}
+
+		// Response sums are accumulated as one vector when there are 2, 4 or 8 of them
+		bool vectorResponses = vectorWidth(genes.getConnectionResponseSize()) > 0;
+
+		auto responseSum = [vectorResponses](int i) {
+			return (vectorResponses ? "responseSum.s" : "responseSum") + std::to_string(i);
+		};
+
+		step +=
+			"	// Update connections\n";
+
+		// Declare response accumulators
+		if (vectorResponses)
+			step += "	" + vectorType(genes.getConnectionResponseSize()) + " responseSum;\n";
+		else {
+			for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
+				step += "	float responseSum" + std::to_string(i) + ";\n";
+			}
+		}
+
+		step +=
+			"\n";
+
+		// Initialize response accumulators
+		step +=
+			"	if (nodeInputOutputIndicesPlusOne.x == 0) {\n";
+
+		if (vectorResponses)
+			step += "		responseSum = (" + vectorType(genes.getConnectionResponseSize()) + ")(0.0f);\n";
+		else {
+			for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
+				step += "		responseSum" + std::to_string(i) + " = 0.0f;\n";
+			}
+		}
+
+		// One connection: gather the neighbour, run the rule, accumulate its response and update its recurrent state. Unindented.
+		// With ci < 0 it is the body of a loop over ci, otherwise connection ci with its offset known at compile time
+		auto connectionToCL = [&](int ci, bool wrap) {
+			std::string connection = "";
+
+			bool unrolled = ci >= 0;
+
+			int offsetX = unrolled ? ci / field.getConnectionDimensionSize() - connectionRadius : 0;
+			int offsetY = unrolled ? ci % field.getConnectionDimensionSize() - connectionRadius : 0;
+
+			if (unrolled)
+				connection += "int2 connectionNodePosition = nodePosition + (int2)(" + std::to_string(offsetX) + ", " + std::to_string(offsetY) + ");\n";
+			else
+				connection += "int2 connectionNodePosition = nodePosition + offsets[ci];\n";
+
+			if (wrap) {
+				connection +=
+					"\n"
+					"// Wrap the coordinates around\n";
+
+				// A coordinate leaves the field by at most connectionRadius, so one comparison per side wraps it, and only the side the offset points to when it is known
+				for (int axis = 0; axis < 2; axis++) {
+					std::string position = axis == 0 ? "connectionNodePosition.x" : "connectionNodePosition.y";
+					std::string size = axis == 0 ? "fieldWidth" : "fieldHeight";
+
+					int offset = axis == 0 ? offsetX : offsetY;
+
+					if (connectionRadius > (axis == 0 ? fieldWidth : fieldHeight)) {
+						connection +=
+							position + " = " + position + " % " + size + ";\n" +
+							position + " = " + position + " < 0 ? " + position + " + " + size + " : " + position + ";\n";
+					}
+					else if (!unrolled)
+						connection += position + " = " + position + " < 0 ? " + position + " + " + size + " : (" + position + " >= " + size + " ? " + position + " - " + size + " : " + position + ");\n";
+					else if (offset < 0)
+						connection += position + " = " + position + " < 0 ? " + position + " + " + size + " : " + position + ";\n";
+					else if (offset > 0)
+						connection += position + " = " + position + " >= " + size + " ? " + position + " - " + size + " : " + position + ";\n";
+				}
+			}
+
+			connection +=
+				"\n";
+
+			if (unrolled)
+				connection += "int connectionStartOffset = connectionsStartOffset + " + std::to_string(ci * field.getConnectionSize()) + " * slotStride;\n";
+			else
+				connection += "int connectionStartOffset = connectionsStartOffset + ci * connectionSize * slotStride;\n";
+
+			if (tiled && !substepLoop) {
+				if (unrolled)
+					connection += "int tileIndex = localPosition.x + " + std::to_string(connectionRadius + offsetX) + " + (localPosition.y + " + std::to_string(connectionRadius + offsetY) + ") * tileHaloWidth;\n";
+				else
+					connection += "int tileIndex = localPosition.x + connectionRadius + offsets[ci].x + (localPosition.y + connectionRadius + offsets[ci].y) * tileHaloWidth;\n";
+			}
+			else {
+				connection +=
+					"int connectionNodeIndex = connectionNodePosition.x + connectionNodePosition.y * fieldWidth;\n";
+
+				if (!substepLoop)
+					connection += "int connectionNodeStartOffset = fieldStartIndex * nodeStateSize + connectionNodeIndex * nodeStride;\n";
+
+				if (vectorNeighbourOutputs)
+					connection += vectorType(genes.getNodeOutputSize()) + " connectionNodeOutputs = vload" + std::to_string(genes.getNodeOutputSize()) + "(0, source + connectionNodeStartOffset);\n";
+			}
+
+			for (int i = 0; i < genes.getTypeSize(); i++)
+			if (connectionNodeTypeUsed(i)) {
+				connection += "float connectionNodeType" + std::to_string(i) + " = " + neighbourSlot(genes.getNodeOutputSize() + i) + ";\n";
+			}
+
+			connection +=
+				"\n";
+
+			// Provide temporaries for holding outputs
+			for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
+				connection += "float response" + std::to_string(i) + ";\n";
+			}
+
+			// Assign changeable recurrent values
+			connection += loadRecurrentsToCL("connectionRec", "connectionStartOffset", connectionPhenotype.getRecurrentNodeIndices().size());
+
+			connection += "\n"
+				"connectionRule(";
+
+			// Add inputs
+			for (int i = 0; i < genes.getNodeOutputSize(); i++) {
+				connection += connectionInput(i, "connectionStrengthScalar * " + neighbourSlot(i)) + ", ";
+			}
+
+			// Type inputs
+			for (int i = 0; i < genes.getTypeSize(); i++) {
+				connection += connectionInput(connectionTypeInputsStart + i, "nodeType" + std::to_string(i)) + ", ";
+			}
+
+			// Connection type inputs
+			for (int i = 0; i < genes.getTypeSize(); i++) {
+				connection += connectionInput(connectionNodeTypeInputsStart + i, "connectionNodeType" + std::to_string(i)) + ", ";
+			}
+
+			// Offset, random and reward inputs
+			connection +=
+				connectionInput(connectionOffsetInputsStart, unrolled ? std::to_string(offsetX) + ".0f" : "(float)(offsets[ci].x)") + ", " +
+				connectionInput(connectionOffsetInputsStart + 1, unrolled ? std::to_string(offsetY) + ".0f" : "(float)(offsets[ci].y)") + ", " +
+				connectionInput(connectionOffsetInputsStart + 2, "read_imagef(randomImage, normalizedRepeatNearestSampler, (float2)(connectionNodePosition.x + nodePosition.x, connectionNodePosition.y + nodePosition.y) * randomImageSizeInv).x") + ", " +
+				connectionInput(connectionOffsetInputsStart + 3, "reward") + ", ";
+
+			// Add outputs
+			for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
+				connection += "&response" + std::to_string(i) + ", ";
+			}
+
+			// Add recurrent connections
+			for (size_t i = 0; i < connectionPhenotype.getRecurrentNodeIndices().size(); i++) {
+				connection += "&connectionRec" + std::to_string(i) + ", ";
+			}
+
+			if (pRuleWeights != nullptr)
+				connection += "ruleWeights, ";
+
+			if (pRuleCode != nullptr)
+				connection += "ruleCode, ";
+
+			connection.pop_back();
+			connection.pop_back();
+
+			connection +=
+				");\n"
+				"\n"
+				"// Accumulate response\n";
+
+			if (vectorResponses)
+				connection += "responseSum += " + vectorOf("response", genes.getConnectionResponseSize()) + ";\n";
+			else {
+				for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
+					connection += "responseSum" + std::to_string(i) + " += response" + std::to_string(i) + ";\n";
+				}
+			}
+
+			connection +=
+				"\n"
+				"// Update recurrent values in place\n";
+
+			connection += storeRecurrentsToCL("connectionRec", "connectionStartOffset", connectionPhenotype.getRecurrentNodeIndices().size());
+
+			return connection;
+		};
+
+		// All connections of a node in offset order, each in its own block when unrolled. Unindented
+		auto connectionsToCL = [&](bool wrap) {
+			std::string connections = "";
+
+			if (field.getUnrollConnections()) {
+				for (int ci = 0; ci < field.getNumConnections(); ci++)
+					connections += std::string(ci > 0 ? "\n" : "") + "{\n" + indent(connectionToCL(ci, wrap)) + "}\n";
+			}
+			else
+				connections += "for (int ci = 0; ci < numConnections; ci++) {\n" + indent(connectionToCL(-1, wrap)) + "}\n";
+
+			return connections;
+		};
+
+		step +=
+			"\n";
+
+		// Nodes at least connectionRadius from the border never wrap around, so the wrapped connections are only needed near the border
+		if (fieldWidth > 2 * connectionRadius && fieldHeight > 2 * connectionRadius) {
+			step +=
+				"		if (nodePosition.x >= " + std::to_string(connectionRadius) + " && nodePosition.x < " + std::to_string(fieldWidth - connectionRadius) +
+				" && nodePosition.y >= " + std::to_string(connectionRadius) + " && nodePosition.y < " + std::to_string(fieldHeight - connectionRadius) + ") {\n" +
+				indent(indent(indent(connectionsToCL(false)))) +
+				"		}\n"
+				"		else {\n" +
+				indent(indent(indent(connectionsToCL(true)))) +
+				"		}\n";
+		}
+		else
+			step += indent(indent(connectionsToCL(true)));
+
+
+		step +=
+			"	}\n"
+			"	else {\n";
+
+		for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
+			step += "		" + responseSum(i) + " = read_imagef(inputImage, unnormalizedClampedNearestSampler, fieldIndex * inputsPerField + ((int)(nodeInputOutputIndicesPlusOne.x) - 1) * " + std::to_string(genes.getConnectionResponseSize()) + " + " + std::to_string(i) + ").x;\n";
+		}
+
+		step +=
+			"	}\n"
+			"\n";
+
+		// Node state of nodeUpdateSubsteps is declared before its substep loop
+		if (!substepLoop) {
+			// Gather gas
+			for (int i = 0; i < field.getNumGases(); i++)
+			if (nodeInputsUsed[nodeGasInputsStart + i]) {
+				step += "	float gasIn" + std::to_string(i) + " = gasSource[gasStartOffset + fieldArea * " + std::to_string(i) + "];\n";
+			}
+
+			// Write values for new gas production
+			for (int i = 0; i < field.getNumGases(); i++) {
+				step += "	float gasOut" + std::to_string(i) + ";\n";
+			}
+
+			// Update activation
+			for (int i = 0; i < genes.getNodeOutputSize(); i++) {
+				step += "	float output" + std::to_string(i) + ";\n";
+			}
+
+			// Assign changeable recurrent values
+			step += indent(loadRecurrentsToCL("nodeRec", "recurrentStartOffset", nodePhenotype.getRecurrentNodeIndices().size()));
+
+			step += "\n";
+		}
+
+		step +=
+			"	activationRule(";
+
+		// Add inputs
+		for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
+			step += nodeInput(i, "nodeOutputStrengthScalar * " + responseSum(i)) + ", ";
+		}
+
+		// Add gas
+		for (int i = 0; i < genes.getNumGases(); i++) {
+			step += nodeInput(nodeGasInputsStart + i, "gasIn" + std::to_string(i)) + ", ";
+		}
+
+		// Type inputs
+		for (int i = 0; i < genes.getTypeSize(); i++) {
+			step += nodeInput(nodeTypeInputsStart + i, "nodeType" + std::to_string(i)) + ", ";
+		}
+
+		// Random and reward inputs
+		step +=
+			nodeInput(nodeRandomInputIndex, "read_imagef(randomImage, normalizedRepeatNearestSampler, (float2)(nodePosition.x - 1, nodePosition.y - 1) * randomImageSizeInv).x") + ", " +
+			nodeInput(nodeRandomInputIndex + 1, "reward") + ", ";
+
+		// Add outputs
+		for (int i = 0; i < genes.getNodeOutputSize(); i++) {
+			step += "&output" + std::to_string(i) + ", ";
+		}
+
+		// Add gas
+		for (int i = 0; i < genes.getNumGases(); i++) {
+			step += "&gasOut" + std::to_string(i) + ", ";
+		}
+
+		// Add recurrent connections
+		for (size_t i = 0; i < nodePhenotype.getRecurrentNodeIndices().size(); i++) {
+			step += "&nodeRec" + std::to_string(i) + ", ";
+		}
+
+		if (pRuleWeights != nullptr)
+			step += "ruleWeights, ";
+
+		if (pRuleCode != nullptr)
+			step += "ruleCode, ";
+
+		step.pop_back();
+		step.pop_back();
+
+		step +=
+			");\n";
+
+		return step;
+	};
+
+	// Writes the final node state and gas production, and the outputs of output nodes
+	auto writeBackToCL = [&]() {
+		std::string writeBack = "";
+
+		writeBack +=
+			"	// Assign to destination buffer\n";
+
+		if (contiguousSlots && vectorWidth(genes.getNodeOutputSize()) > 0)
+			writeBack += "	vstore" + std::to_string(genes.getNodeOutputSize()) + "(" + vectorOf("output", genes.getNodeOutputSize()) + ", 0, destination + nodeStartOffset);\n";
+		else {
+			for (int i = 0; i < genes.getNodeOutputSize(); i++) {
+				writeBack += "	destination[nodeStartOffset + " + slotOffset(i) + "] = output" + std::to_string(i) + ";\n";
+			}
+		}
+
+		writeBack +=
+			"\n"
+			"	// Update recurrent values in place\n";
+
+		writeBack += indent(storeRecurrentsToCL("nodeRec", "recurrentStartOffset", nodePhenotype.getRecurrentNodeIndices().size()));
+
+		writeBack +=
+			"\n"
+			"	// Assign gas production values to destination buffer\n";
+
+		for (int i = 0; i < genes.getNumGases(); i++) {
+			writeBack += "	gasDestination[gasStartOffset + fieldArea * " + std::to_string(i) + "] = gasOut" + std::to_string(i) + "; \n";
+		}
+
+		return writeBack;
+	};
+
+	auto writeOutputsToCL = [&]() {
+		std::string writeOutputs = "";
+
+		writeOutputs +=
+			"	if (nodeInputOutputIndicesPlusOne.y != 0) {\n";
+
+		for (int i = 0; i < genes.getNodeOutputSize(); i++) {
+			writeOutputs += "		write_imagef(outputImage, fieldIndex * outputsPerField + ((int)(nodeInputOutputIndicesPlusOne.y) - 1) * " + std::to_string(genes.getNodeOutputSize()) + " + " + std::to_string(i) + ", (float4)(output" + std::to_string(i) + "));\n";
+		}
+
+		writeOutputs +=
+			"	}\n";
+
+		return writeOutputs;
+	};
+
 	code +=
 		"\n"
-		"	uint2 nodeInputOutputIndicesPlusOne = read_imageui(typeImage, unnormalizedClampedNearestSampler, nodePosition).xy;\n"
-		"\n"
-		"	// Update connections\n";
+		"// The kernel\n"
+		"void kernel nodeUpdate(global const float* source, global const float* gasSource, global float* destination, global float* gasDestination, read_only image2d_t typeImage, read_only image1d_t inputImage, write_only image1d_t outputImage, read_only image2d_t randomImage, global const float* rewards, global " + recurrentType + "* recurrent, global const float* nodeTypes, constant float* ruleWeights, constant int* ruleCode) {\n"
+		"	int2 nodePosition = (int2)(get_global_id(0), get_global_id(1));\n"
+		"	int fieldIndex = get_global_id(2);\n"
+		"	int fieldStartIndex = fieldIndex * fieldArea;\n"
+		"	int nodeIndex = nodePosition.x + nodePosition.y * fieldWidth;\n"
+		"	int nodeStartOffset = fieldStartIndex * nodeStateSize + nodeIndex * nodeStride;\n"
+		"	int recurrentStartOffset = fieldStartIndex * recurrentStateSize + nodeIndex * recurrentNodeStride;\n"
+		"	int gasStartOffset = fieldStartIndex * numGases + nodeIndex;\n";
 
-	// Declare response accumulators
-	for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
-		code += "	float responseSum" + std::to_string(i) + ";\n";
-	}
+	if (rewardUsed)
+		code += "	float reward = rewards[fieldIndex];\n";
 
 	code +=
-		"\n";
+		"	int connectionsStartOffset = recurrentStartOffset + nodeRecurrentSize * slotStride;\n"
+		"	float2 normalizedCoords = ((float2)(nodePosition.x, nodePosition.y)) * ((float2)(fieldWidthInv, fieldHeightInv));\n";
 
-	// Initialize response accumulators
-	code +=
-		"	if (nodeInputOutputIndicesPlusOne.x == 0) {\n";
+	code += strengthScalarsToCL;
 
-	for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
-		code += "		responseSum" + std::to_string(i) + " = 0.0f;\n";
+	for (int i = 0; i < genes.getTypeSize(); i++)
+	if (nodeTypeUsed(i)) {
+		code +=	"	float nodeType" + std::to_string(i) + " = nodeTypes[nodeIndex * typeNodeStride + " + slotOffset(i) + "];\n";
 	}
 
 	code +=
 		"\n"
-		"		for (int ci = 0; ci < numConnections; ci++) {\n"
-		"			int2 connectionNodePosition = nodePosition + offsets[ci];\n"
-		"\n"
-		"			// Wrap the coordinates around\n"
-		"			connectionNodePosition.x = connectionNodePosition.x % fieldWidth;\n"
-		"			connectionNodePosition.y = connectionNodePosition.y % fieldHeight;\n"
-		"			connectionNodePosition.x = connectionNodePosition.x < 0 ? connectionNodePosition.x + fieldWidth : connectionNodePosition.x;\n"
-		"			connectionNodePosition.y = connectionNodePosition.y < 0 ? connectionNodePosition.y + fieldHeight : connectionNodePosition.y;\n"
-		"\n"
-		"			int connectionNodeIndex = connectionNodePosition.x + connectionNodePosition.y * fieldWidth;\n"
-		"			int connectionNodeStartOffset = connectionNodeIndex * nodeAndConnectionsSize;\n"
-		"			int connectionStartOffset = connectionsStartOffset + ci * connectionSize;\n";
+		"	uint2 nodeInputOutputIndicesPlusOne = read_imageui(typeImage, unnormalizedClampedNearestSampler, nodePosition).xy;\n"
+		"\n";
 
-	for (int i = 0; i < genes.getTypeSize(); i++) {
-		code += "			float connectionNodeType" + std::to_string(i) + " = source[connectionNodeStartOffset + " + std::to_string(genes.getNodeOutputSize() + i) + "];\n";
-	}
+	if (tiled) {
+		code +=
+			"	// Load outputs and types of the tile and its halo into local memory, one plane per slot\n"
+			"	local float tile[" + std::to_string(tileSlots) + " * tileHaloArea];\n"
+			"\n"
+			"	int2 localPosition = (int2)(get_local_id(0), get_local_id(1));\n"
+			"	int2 tileOrigin = (int2)((int)get_group_id(0) * tileWidth - connectionRadius, (int)get_group_id(1) * tileHeight - connectionRadius);\n"
+			"\n"
+			"	for (int ti = localPosition.x + localPosition.y * tileWidth; ti < tileHaloArea; ti += tileWidth * tileHeight) {\n"
+			"		int2 tileNodePosition = tileOrigin + (int2)(ti % tileHaloWidth, ti / tileHaloWidth);\n"
+			"\n"
+			"		// Wrap the coordinates around\n"
+			"		tileNodePosition.x = tileNodePosition.x % fieldWidth;\n"
+			"		tileNodePosition.y = tileNodePosition.y % fieldHeight;\n"
+			"		tileNodePosition.x = tileNodePosition.x < 0 ? tileNodePosition.x + fieldWidth : tileNodePosition.x;\n"
+			"		tileNodePosition.y = tileNodePosition.y < 0 ? tileNodePosition.y + fieldHeight : tileNodePosition.y;\n"
+			"\n"
+			"		int tileNodeIndex = tileNodePosition.x + tileNodePosition.y * fieldWidth;\n"
+			"		int tileNodeStartOffset = fieldStartIndex * nodeStateSize + tileNodeIndex * nodeStride;\n"
+			"\n";
+
+		for (int i = 0; i < genes.getNodeOutputSize(); i++)
+		if (connectionInputsUsed[i]) {
+			code += "		tile[ti + " + std::to_string(i) + " * tileHaloArea] = source[tileNodeStartOffset + " + slotOffset(i) + "];\n";
+		}
 
-	code +=
-		"\n";
+		for (int i = 0; i < genes.getTypeSize(); i++)
+		if (connectionNodeTypeUsed(i)) {
+			code += "		tile[ti + " + std::to_string(genes.getNodeOutputSize() + i) + " * tileHaloArea] = nodeTypes[tileNodeIndex * typeNodeStride + " + slotOffset(i) + "];\n";
+		}
 
-	// Provide temporaries for holding outputs
-	for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
-		code += "			float response" + std::to_string(i) + ";\n";
+		code +=
+			"	}\n"
+			"\n"
+			"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+			"\n";
 	}
 
-	// Assign changeable recurrent values
-	for (int i = 0; i < connectionPhenotype.getRecurrentNodeIndices().size(); i++) {
-		code += "			float connectionRec" + std::to_string(i) + " = source[connectionStartOffset + " + std::to_string(i) + "];\n";
-	}
+	code += stepToCL(false);
 
-	code += "\n"
-		"			connectionRule(";
+	code +=
+		"\n";
 
-	// Add inputs
-	for (int i = 0; i < genes.getNodeOutputSize(); i++) {
-		code += "connectionStrengthScalar * source[connectionNodeStartOffset + " + std::to_string(i) + "], ";
-	}
+	code += writeBackToCL();
 
-	// Type inputs
-	for (int i = 0; i < genes.getTypeSize(); i++) {
-		code += "nodeType" + std::to_string(i) + ", ";
-	}
+	// Finish kernel by writing output if it exists
+	code +=
+		"\n";
 
-	// Connection type inputs
-	for (int i = 0; i < genes.getTypeSize(); i++) {
-		code += "connectionNodeType" + std::to_string(i) + ", ";
-	}
+	code += writeOutputsToCL();
 
-	// Offset, random and reward inputs
 	code +=
-		"(float)(offsets[ci].x), (float)(offsets[ci].y), read_imagef(randomImage, normalizedRepeatNearestSampler, (float2)(connectionNodePosition.x + nodePosition.x, connectionNodePosition.y + nodePosition.y) * randomImageSizeInv).x, reward, ";
+		"}";
 
-	// Add outputs
-	for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
-		code += "&response" + std::to_string(i) + ", ";
-	}
+	if (!field.getUseSubstepKernel())
+		return ProgramCache::programScopeNamesToCL(programScopeNames) + code;
 
-	// Add recurrent connections
-	for (int i = 0; i < connectionPhenotype.getRecurrentNodeIndices().size(); i++) {
-		code += "&connectionRec" + std::to_string(i) + ", ";
-	}
+	programScopeNames.push_back("fieldOutputsSize");
+	programScopeNames.push_back("nodeUpdateSubsteps");
 
-	code.pop_back();
-	code.pop_back();
+	// Variant running all substeps in a single launch, for fields that fit in one work-group
+	int fieldOutputsSize = genes.getNodeOutputSize() * fieldWidth * fieldHeight;
 
 	code +=
-		");\n"
 		"\n"
-		"			// Accumulate response\n";
+		"\n"
+		"// Size of one copy of the node outputs of a field\n"
+		"constant int fieldOutputsSize = " + std::to_string(fieldOutputsSize) + ";\n"
+		"\n"
+		"// All substeps in one launch. The work-group is the whole field, whose node outputs are exchanged through local memory between substeps\n"
+		"void kernel nodeUpdateSubsteps(global const float* source, global float* gasSource, global float* destination, global float* gasDestination, read_only image2d_t typeImage, read_only image1d_t inputImage, write_only image1d_t outputImage, read_only image2d_t randomImage, int substeps, global const float* rewards, global " + recurrentType + "* recurrent, global const float* nodeTypes, constant float* ruleWeights, constant int* ruleCode) {\n"
+		"	int2 nodePosition = (int2)(get_global_id(0), get_global_id(1));\n"
+		"	int fieldIndex = get_global_id(2);\n"
+		"	int fieldStartIndex = fieldIndex * fieldArea;\n"
+		"	int nodeIndex = nodePosition.x + nodePosition.y * fieldWidth;\n"
+		"	int nodeStartOffset = fieldStartIndex * nodeStateSize + nodeIndex * nodeStride;\n"
+		"	int recurrentStartOffset = fieldStartIndex * recurrentStateSize + nodeIndex * recurrentNodeStride;\n"
+		"	int gasStartOffset = fieldStartIndex * numGases + nodeIndex;\n";
 
-	for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
-		code += "			responseSum" + std::to_string(i) + " += response" + std::to_string(i) + ";\n";
-	}
+	if (rewardUsed)
+		code += "	float reward = rewards[fieldIndex];\n";
 
 	code +=
-		"\n"
-		"			// Assign recurrent values to destination buffer\n";
+		"	int connectionsStartOffset = recurrentStartOffset + nodeRecurrentSize * slotStride;\n";
 
-	for (int i = 0; i < connectionPhenotype.getRecurrentNodeIndices().size(); i++) {
-		code += "			destination[connectionStartOffset + " + std::to_string(i) + "] = connectionRec" + std::to_string(i) + ";\n";
-	}
+	code += strengthScalarsToCL;
 
-	// ----------------------------------------------------------- Finish block -----------------------------------------------------------
+	// Node types are also published to the neighbours
+	for (int i = 0; i < genes.getTypeSize(); i++)
+	if (nodeTypeUsed(i) || connectionNodeTypeUsed(i)) {
+		code +=	"	float nodeType" + std::to_string(i) + " = nodeTypes[nodeIndex * typeNodeStride + " + slotOffset(i) + "];\n";
+	}
 
 	code +=
-		"		}\n";
+		"\n"
+		"	uint2 nodeInputOutputIndicesPlusOne = read_imageui(typeImage, unnormalizedClampedNearestSampler, nodePosition).xy;\n"
+		"\n"
+		"	// Node outputs (double buffered) and types of the whole field\n"
+		"	local float fieldOutputs[2 * fieldOutputsSize];\n"
+		"	local float fieldTypes[" + std::to_string(std::max(1, genes.getTypeSize()) * fieldWidth * fieldHeight) + "];\n"
+		"\n";
 
+	if (contiguousSlots && vectorWidth(genes.getNodeOutputSize()) > 0) {
+		code += "	" + vectorType(genes.getNodeOutputSize()) + " nodeOutputs = vload" + std::to_string(genes.getNodeOutputSize()) + "(0, source + nodeStartOffset);\n";
 
-	code +=
-		"	}\n"
-		"	else {\n";
+		for (int i = 0; i < genes.getNodeOutputSize(); i++) {
+			code += "	fieldOutputs[nodeIndex + " + std::to_string(i) + " * fieldArea] = nodeOutputs.s" + std::to_string(i) + ";\n";
+		}
+	}
+	else {
+		for (int i = 0; i < genes.getNodeOutputSize(); i++) {
+			code += "	fieldOutputs[nodeIndex + " + std::to_string(i) + " * fieldArea] = source[nodeStartOffset + " + slotOffset(i) + "];\n";
+		}
+	}
 
-	for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
-		code += "		responseSum" + std::to_string(i) + " = read_imagef(inputImage, unnormalizedClampedNearestSampler, ((int)(nodeInputOutputIndicesPlusOne.x) - 1) * " + std::to_string(genes.getConnectionResponseSize()) + " + " + std::to_string(i) + ").x;\n";
+	for (int i = 0; i < genes.getTypeSize(); i++)
+	if (connectionNodeTypeUsed(i)) {
+		code += "	fieldTypes[nodeIndex + " + std::to_string(i) + " * fieldArea] = nodeType" + std::to_string(i) + ";\n";
 	}
 
 	code +=
-		"	}\n"
-		"\n";
-	
-	// Gather gas
+		"\n"
+		"	// Own node state stays in private memory between substeps\n";
+
 	for (int i = 0; i < field.getNumGases(); i++) {
-		code += "	float gasIn" + std::to_string(i) + " = gasSource[nodeIndex + fieldArea * " + std::to_string(i) + "];\n";
+		code += "	float gasIn" + std::to_string(i) + " = gasSource[gasStartOffset + fieldArea * " + std::to_string(i) + "];\n";
 	}
 
-	// Write values for new gas production
 	for (int i = 0; i < field.getNumGases(); i++) {
 		code += "	float gasOut" + std::to_string(i) + ";\n";
 	}
 
-	// Update activation
 	for (int i = 0; i < genes.getNodeOutputSize(); i++) {
 		code += "	float output" + std::to_string(i) + ";\n";
 	}
 
-	// Assign changeable recurrent values
-	for (int i = 0; i < nodePhenotype.getRecurrentNodeIndices().size(); i++) {
-		code += "	float nodeRec" + std::to_string(i) + " =  source[nodeStartOffset + " + std::to_string(genes.getNodeOutputSize() + genes.getTypeSize() + i) + "];\n";
-	}
-
-	code += "\n"
-		"	activationRule(";
+	code += indent(loadRecurrentsToCL("nodeRec", "recurrentStartOffset", nodePhenotype.getRecurrentNodeIndices().size()));
 
-	// Add inputs
-	for (int i = 0; i < genes.getConnectionResponseSize(); i++) {
-		code += "nodeOutputStrengthScalar * responseSum" + std::to_string(i) + ", ";
-	}
+	code +=
+		"\n"
+		"	barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"\n"
+		"	for (int s = 0; s < substeps; s++) {\n"
+		"		int readOffset = (s % 2) * fieldOutputsSize;\n"
+		"		int writeOffset = fieldOutputsSize - readOffset;\n";
 
-	// Add gas
-	for (int i = 0; i < genes.getNumGases(); i++) {
-		code += "gasIn" + std::to_string(i) + ", ";
-	}
+	code +=
+		"\n";
 
-	// Type inputs
-	for (int i = 0; i < genes.getTypeSize(); i++) {
-		code += "nodeType" + std::to_string(i) + ", ";
-	}
+	code += indent(stepToCL(true));
 
-	// Random and reward inputs
 	code +=
-		"read_imagef(randomImage, normalizedRepeatNearestSampler, (float2)(nodePosition.x - 1, nodePosition.y - 1) * randomImageSizeInv).x, reward, ";
+		"\n"
+		"		// Publish outputs for the next substep\n";
 
-	// Add outputs
 	for (int i = 0; i < genes.getNodeOutputSize(); i++) {
-		code += "&output" + std::to_string(i) + ", ";
+		code += "		fieldOutputs[writeOffset + nodeIndex + " + std::to_string(i) + " * fieldArea] = output" + std::to_string(i) + ";\n";
 	}
 
-	// Add gas
-	for (int i = 0; i < genes.getNumGases(); i++) {
-		code += "&gasOut" + std::to_string(i) + ", ";
-	}
+	if (genes.getNumGases() > 0) {
+		code +=
+			"\n"
+			"		// Gas production feeds the next substep\n"
+			"		if (s < substeps - 1) {\n";
 
-	// Add recurrent connections
-	for (int i = 0; i < nodePhenotype.getRecurrentNodeIndices().size(); i++) {
-		code += "&nodeRec" + std::to_string(i) + ", ";
-	}
-
-	code.pop_back();
-	code.pop_back();
-
-	code +=
-		");\n"
-		"\n"
-		"	// Assign to destination buffer\n";
+		for (int i = 0; i < genes.getNumGases(); i++) {
+			code += "			gasIn" + std::to_string(i) + " = gasOut" + std::to_string(i) + ";\n";
+		}
 
-	for (int i = 0; i < genes.getNodeOutputSize(); i++) {
-		code += "	destination[nodeStartOffset + " + std::to_string(i) + "] = output" + std::to_string(i) + ";\n";
+		code +=
+			"		}\n";
 	}
 
 	code +=
 		"\n"
-		"	// Assign recurrent values to destination buffer\n";
+		"		barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"	}\n"
+		"\n";
 
-	for (int i = 0; i < nodePhenotype.getRecurrentNodeIndices().size(); i++) {
-		code += "	destination[nodeStartOffset + " + std::to_string(genes.getNodeOutputSize() + genes.getTypeSize() + i) + "] = nodeRec" + std::to_string(i) + ";\n";
-	}
+	code += writeBackToCL();
 
 	code +=
 		"\n"
-		"	// Assign gas production values to destination buffer\n";
+		"	// Leave the gas input of the last substep in the source gas buffer, like separate launches per substep would\n";
 
 	for (int i = 0; i < genes.getNumGases(); i++) {
-		code += "	gasDestination[nodeIndex + fieldArea * " + std::to_string(i) + "] = gasOut" + std::to_string(i) + "; \n";
+		code += "	gasSource[gasStartOffset + fieldArea * " + std::to_string(i) + "] = gasIn" + std::to_string(i) + ";\n";
 	}
 
-	// Finish kernel by writing output if it exists
 	code +=
-		"\n"
-		"	if (nodeInputOutputIndicesPlusOne.y != 0) {\n";
+		"\n";
 
-	for (int i = 0; i < genes.getNodeOutputSize(); i++) {
-		code += "		write_imagef(outputImage, ((int)(nodeInputOutputIndicesPlusOne.y) - 1) * " + std::to_string(genes.getNodeOutputSize()) + " + " + std::to_string(i) + ", (float4)(output" + std::to_string(i) + "));\n";
-	}
+	code += writeOutputsToCL();
 
 	code +=
-		"	}\n"
 		"}";
 
-	return code;
-}
\ No newline at end of file
+	return ProgramCache::programScopeNamesToCL(programScopeNames) + code;
+}
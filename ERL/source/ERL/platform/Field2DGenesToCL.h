@@ -12,7 +12,12 @@ Field2DCL genes to OpenCL
 #include <string>
 
 namespace erl {
+	// With pRuleWeights, the strength scalars and rule weights are written to it and read from the ruleWeights kernel argument,
+	// so fields whose rules share a topology generate the same source.
+	// With pRuleCode (requires pRuleWeights), the rules are compiled to bytecode in it and run by an interpreter, so the source only depends on the field
+	// and the number of rule recurrents. Returns an empty string and clears pRuleCode if a rule exceeds the interpreter limits
 	std::string field2DGenesNodeUpdateToCL(erl::Field2DGenes &genes, const erl::Field2DCL &field,
 		ne::Phenotype &connectionPhenotype, ne::Phenotype &nodePhenotype,
-		const std::vector<std::string> &functionNames, int fieldWidth, int fieldHeight, int connectionRadius, int numInputs, int numOutputs);
+		const std::vector<std::string> &functionNames, int fieldWidth, int fieldHeight, int connectionRadius, int numInputs, int numOutputs,
+		std::vector<float>* pRuleWeights = nullptr, std::vector<int>* pRuleCode = nullptr);
 }
\ No newline at end of file
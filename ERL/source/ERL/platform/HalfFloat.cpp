@@ -0,0 +1,50 @@
+#include <erl/platform/HalfFloat.h>
+
+#include <cstring>
+
+unsigned short erl::floatToHalf(float value) {
+	unsigned int bits;
+	std::memcpy(&bits, &value, sizeof(float));
+
+	unsigned int sign = (bits >> 16) & 0x8000;
+	unsigned int exponent = (bits >> 23) & 0xff;
+	unsigned int mantissa = bits & 0x7fffff;
+
+	// Infinity and NaN
+	if (exponent == 0xff)
+		return static_cast<unsigned short>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+
+	int halfExponent = static_cast<int>(exponent) - 127 + 15;
+
+	// Too large, becomes infinity
+	if (halfExponent >= 31)
+		return static_cast<unsigned short>(sign | 0x7c00);
+
+	// Denormal or zero
+	if (halfExponent <= 0) {
+		if (halfExponent < -10)
+			return static_cast<unsigned short>(sign);
+
+		mantissa |= 0x800000;
+
+		int shift = 14 - halfExponent;
+
+		unsigned int halfMantissa = mantissa >> shift;
+		unsigned int remainder = mantissa & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+
+		if (remainder > halfway || (remainder == halfway && (halfMantissa & 1)))
+			halfMantissa++;
+
+		return static_cast<unsigned short>(sign | halfMantissa);
+	}
+
+	unsigned int half = sign | (static_cast<unsigned int>(halfExponent) << 10) | (mantissa >> 13);
+	unsigned int remainder = mantissa & 0x1fff;
+
+	// Rounding may carry into the exponent, which correctly rounds up to the next power of two or infinity
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+
+	return static_cast<unsigned short>(half);
+}
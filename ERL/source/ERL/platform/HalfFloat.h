@@ -0,0 +1,12 @@
+/*
+ERL
+
+Half Float
+*/
+
+#pragma once
+
+namespace erl {
+	// Convert to IEEE 754 binary16 bits (round to nearest even), the format read by vload_half
+	unsigned short floatToHalf(float value);
+}
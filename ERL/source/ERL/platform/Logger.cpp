@@ -18,6 +18,8 @@ void Logger::close() {
 }
 
 Logger &Logger::operator<<(const std::string &str) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
 	if (_showInConsole)
 		std::cout << str;
 
@@ -9,6 +9,7 @@ Logger
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <mutex>
 
 namespace erl {
 	const std::string endl = "\n";
@@ -19,6 +20,10 @@ namespace erl {
 
 		bool _showInConsole;
 
+		// Several threads may log at once. Each << is written whole, so code that may run on several threads
+		// builds a line with + and writes it with a single <<
+		std::mutex _mutex;
+
 	public:
 		~Logger() {
 			close();
@@ -0,0 +1,488 @@
+#include <erl/platform/ProgramCache.h>
+
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <unordered_set>
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace erl;
+
+// Create a single directory level, fails if it already exists
+bool createDirectory(const std::string &directory) {
+#ifdef _WIN32
+	return _mkdir(directory.c_str()) == 0;
+#else
+	return mkdir(directory.c_str(), 0755) == 0;
+#endif
+}
+
+const char* const ProgramCache::nameSuffixMacro = "ERL_NAME_SUFFIX";
+
+std::string ProgramCache::programScopeNamesToCL(const std::vector<std::string> &names) {
+	// Pasted through a second macro, so the suffix macro is expanded first. A name in its own replacement is not expanded again
+	std::string code =
+		"// Program scope names get the suffix " + std::string(nameSuffixMacro) + " when it is defined, so several sources can be built as one program\n"
+		"#ifdef " + nameSuffixMacro + "\n"
+		"#define ERL_PASTE_NAME(name, suffix) name##suffix\n"
+		"#define ERL_SUFFIX_NAME(name, suffix) ERL_PASTE_NAME(name, suffix)\n";
+
+	for (size_t i = 0; i < names.size(); i++)
+		code += "#define " + names[i] + " ERL_SUFFIX_NAME(" + names[i] + ", " + nameSuffixMacro + ")\n";
+
+	code +=
+		"#endif\n"
+		"\n";
+
+	return code;
+}
+
+std::shared_ptr<cl::Program> ProgramCache::get(cl::Context &context, cl::Device &device, const std::string &source, const std::string &options, Logger &logger, std::string* pNameSuffix) {
+	// Options can not contain a null character, so they are separated from the source by one
+	std::string key = options + '\0' + source;
+
+	std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+	std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it = _keyToEntry.find(key);
+
+	if (it != _keyToEntry.end()) {
+		// Callers that do not handle name suffixes get a program of their own
+		if (it->second->_nameSuffix.empty() || pNameSuffix != nullptr) {
+			_numHits++;
+
+			// Move to front
+			_entries.splice(_entries.begin(), _entries, it->second);
+
+			if (pNameSuffix != nullptr)
+				*pNameSuffix = it->second->_nameSuffix;
+
+			return it->second->_program;
+		}
+
+		_totalSize -= it->second->_size;
+
+		_entries.erase(it->second);
+		_keyToEntry.erase(it);
+	}
+
+	if (pNameSuffix != nullptr)
+		pNameSuffix->clear();
+
+	std::shared_ptr<cl::Program> program;
+
+	std::string diskKey;
+
+	if (!_directory.empty())
+		diskKey = device.getInfo<CL_DEVICE_NAME>() + '\0' + device.getInfo<CL_DRIVER_VERSION>() + '\0' + key;
+
+	std::shared_ptr<BuildItem> item;
+
+	std::unordered_map<std::string, std::shared_ptr<BuildItem>>::iterator buildIt = _keyToBuildItem.find(key);
+
+	if (buildIt != _keyToBuildItem.end()) {
+		item = buildIt->second;
+
+		// Each waiting thread needs its own copy of the future
+		std::shared_future<void> finished = item->_finishedFuture;
+
+		lock.unlock();
+
+		// Only blocks if the build has not finished yet
+		finished.wait();
+
+		lock.lock();
+	}
+	else {
+		item.reset(new BuildItem());
+
+		item->_context = context;
+		item->_device = device;
+		item->_source = source;
+		item->_options = options;
+
+		_keyToBuildItem[key] = item;
+
+		// Disk loads and builds both run outside the lock, other threads missing the program wait for the item
+		lock.unlock();
+
+		if (!diskKey.empty()) {
+			item->_program = loadBinary(context, device, diskKey, options);
+
+			item->_loadedFromDisk = item->_program != nullptr;
+		}
+
+		if (item->_loadedFromDisk) {
+			item->_built = true;
+
+			item->_finished.set_value();
+		}
+		else
+			item->run(0);
+
+		lock.lock();
+	}
+
+	// The first thread done waiting takes the program over, the others just use it
+	buildIt = _keyToBuildItem.find(key);
+
+	if (buildIt == _keyToBuildItem.end() || buildIt->second != item) {
+		_numHits++;
+
+		return item->_built ? item->_program : nullptr;
+	}
+
+	_keyToBuildItem.erase(buildIt);
+
+	_numMisses++;
+
+	if (item->_loadedFromDisk)
+		_numDiskHits++;
+
+	if (!item->_built) {
+		logger << "Error building: " + item->_program->getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) + endl;
+
+		return nullptr;
+	}
+
+	program = item->_program;
+
+	addEntry(key, program);
+
+	lock.unlock();
+
+	// Saved outside the lock too
+	if (!diskKey.empty() && !item->_loadedFromDisk)
+		saveBinary(*program, diskKey, logger);
+
+	return program;
+}
+
+void ProgramCache::buildBatch(cl::Context &context, cl::Device &device, const std::vector<std::string> &sources, const std::string &options, Logger &logger) {
+	std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+	// Sources that are neither in memory nor on disk, without duplicates
+	std::vector<std::string> batchSources;
+	std::unordered_set<std::string> batchSourceSet;
+
+	for (size_t i = 0; i < sources.size(); i++)
+		if (!contains(device, sources[i], options) && batchSourceSet.insert(sources[i]).second)
+			batchSources.push_back(sources[i]);
+
+	lock.unlock();
+
+	// A single program gains nothing from batching, and keeps its binary on disk this way
+	if (batchSources.size() < 2) {
+		for (size_t i = 0; i < batchSources.size(); i++)
+			get(context, device, batchSources[i], options, logger);
+
+		return;
+	}
+
+	std::vector<std::string> nameSuffixes(batchSources.size());
+
+	std::string batchSource;
+
+	for (size_t i = 0; i < batchSources.size(); i++) {
+		nameSuffixes[i] = "_batch" + std::to_string(i);
+
+		batchSource +=
+			"#define " + std::string(nameSuffixMacro) + " " + nameSuffixes[i] + "\n" +
+			batchSources[i] + "\n"
+			"#undef " + nameSuffixMacro + "\n";
+	}
+
+	// Built outside the lock, so gets of other programs do not wait for the batch
+	std::shared_ptr<cl::Program> program(new cl::Program(context, batchSource));
+
+	// Leave the sources to get, which builds and reports them one by one as they are requested
+	if (program->build(std::vector<cl::Device>(1, device), options.c_str()) != CL_SUCCESS) {
+		logger << "Batch of " + std::to_string(batchSources.size()) + " programs did not build, each will be built separately when it is requested" + endl;
+
+		return;
+	}
+
+	size_t binarySize = 0;
+
+	std::vector<size_t> binarySizes = program->getInfo<CL_PROGRAM_BINARY_SIZES>();
+
+	for (size_t i = 0; i < binarySizes.size(); i++)
+		binarySize += binarySizes[i];
+
+	lock.lock();
+
+	for (size_t i = 0; i < batchSources.size(); i++) {
+		Entry entry;
+
+		entry._key = options + '\0' + batchSources[i];
+
+		// A get during the build may have added the program or be building it, never add a key twice
+		if (_keyToEntry.find(entry._key) != _keyToEntry.end() || _keyToBuildItem.find(entry._key) != _keyToBuildItem.end())
+			continue;
+
+		_numMisses++;
+
+		entry._program = program;
+		entry._nameSuffix = nameSuffixes[i];
+		entry._size = entry._key.size() + binarySize / batchSources.size();
+
+		_entries.push_front(entry);
+		_keyToEntry[entry._key] = _entries.begin();
+
+		_totalSize += entry._size;
+	}
+
+	evict();
+}
+
+void ProgramCache::BuildItem::run(size_t) {
+	_program.reset(new cl::Program(_context, _source));
+
+	_built = _program->build(std::vector<cl::Device>(1, _device), _options.c_str()) == CL_SUCCESS;
+
+	_finished.set_value();
+}
+
+void ProgramCache::buildAhead(cl::Context &context, cl::Device &device, const std::string &source, const std::string &options) {
+	std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+	if (contains(device, source, options))
+		return;
+
+	if (_buildThreadPool.getNumWorkers() == 0)
+		_buildThreadPool.create(std::max<size_t>(1, _numBuildThreads));
+
+	std::shared_ptr<BuildItem> item(new BuildItem());
+
+	item->_context = context;
+	item->_device = device;
+	item->_source = source;
+	item->_options = options;
+	item->_builtAhead = true;
+
+	_keyToBuildItem[options + '\0' + source] = item;
+
+	_buildThreadPool.addItem(item);
+}
+
+void ProgramCache::storeBuiltAhead(Logger &logger) {
+	std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+	// Disk keys and programs to save once the lock is released
+	std::vector<std::pair<std::string, std::shared_ptr<cl::Program>>> toSave;
+
+	for (std::unordered_map<std::string, std::shared_ptr<BuildItem>>::iterator it = _keyToBuildItem.begin(); it != _keyToBuildItem.end();) {
+		std::shared_ptr<BuildItem> item = it->second;
+
+		if (!item->_builtAhead || item->_finishedFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			it++;
+
+			continue;
+		}
+
+		std::string key = it->first;
+
+		it = _keyToBuildItem.erase(it);
+
+		_numMisses++;
+
+		if (!item->_built) {
+			logger << "Error building: " + item->_program->getBuildInfo<CL_PROGRAM_BUILD_LOG>(item->_device) + endl;
+
+			continue;
+		}
+
+		// Never add a key twice
+		if (_keyToEntry.find(key) == _keyToEntry.end())
+			addEntry(key, item->_program);
+
+		if (!_directory.empty())
+			toSave.push_back(std::make_pair(item->_device.getInfo<CL_DEVICE_NAME>() + '\0' + item->_device.getInfo<CL_DRIVER_VERSION>() + '\0' + key, item->_program));
+	}
+
+	lock.unlock();
+
+	for (size_t i = 0; i < toSave.size(); i++)
+		saveBinary(*toSave[i].second, toSave[i].first, logger);
+}
+
+bool ProgramCache::contains(cl::Device &device, const std::string &source, const std::string &options) const {
+	std::string key = options + '\0' + source;
+
+	std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+	if (_keyToEntry.find(key) != _keyToEntry.end())
+		return true;
+
+	if (_keyToBuildItem.find(key) != _keyToBuildItem.end())
+		return true;
+
+	if (_directory.empty())
+		return false;
+
+	std::ifstream fromFile(getFileName(device.getInfo<CL_DEVICE_NAME>() + '\0' + device.getInfo<CL_DRIVER_VERSION>() + '\0' + key), std::ios::binary);
+
+	return fromFile.is_open();
+}
+
+void ProgramCache::addEntry(const std::string &key, const std::shared_ptr<cl::Program> &program) {
+	Entry entry;
+
+	entry._key = key;
+	entry._program = program;
+	entry._size = key.size();
+
+	std::vector<size_t> binarySizes = program->getInfo<CL_PROGRAM_BINARY_SIZES>();
+
+	for (size_t i = 0; i < binarySizes.size(); i++)
+		entry._size += binarySizes[i];
+
+	_entries.push_front(entry);
+	_keyToEntry[key] = _entries.begin();
+
+	_totalSize += entry._size;
+
+	evict();
+}
+
+void ProgramCache::evict() {
+	// Always keep the newest program, even if it exceeds the size limit on its own
+	while (_entries.size() > 1 && ((_maxPrograms > 0 && _entries.size() > _maxPrograms) || (_maxSize > 0 && _totalSize > _maxSize))) {
+		_totalSize -= _entries.back()._size;
+
+		_keyToEntry.erase(_entries.back()._key);
+
+		_entries.pop_back();
+	}
+}
+
+void ProgramCache::clear() {
+	std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+	_entries.clear();
+	_keyToEntry.clear();
+	_keyToBuildItem.clear();
+
+	_totalSize = 0;
+}
+
+std::string ProgramCache::getFileName(const std::string &diskKey) const {
+	// 64 bit FNV-1a, stable across runs and compilers. The full key is stored in the file to rule out collisions
+	unsigned long long hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < diskKey.size(); i++) {
+		hash ^= static_cast<unsigned char>(diskKey[i]);
+		hash *= 1099511628211ull;
+	}
+
+	std::ostringstream os;
+
+	os << _directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+
+	return os.str();
+}
+
+std::shared_ptr<cl::Program> ProgramCache::loadBinary(cl::Context &context, cl::Device &device, const std::string &diskKey, const std::string &options) {
+	std::ifstream fromFile(getFileName(diskKey), std::ios::binary);
+
+	if (!fromFile.is_open())
+		return nullptr;
+
+	// Key size, key, binary size, binary
+	unsigned long long keySize = 0;
+
+	fromFile.read(reinterpret_cast<char*>(&keySize), sizeof(keySize));
+
+	if (!fromFile.good() || keySize != diskKey.size())
+		return nullptr;
+
+	std::string key(keySize, '\0');
+
+	fromFile.read(&key[0], keySize);
+
+	if (!fromFile.good() || key != diskKey)
+		return nullptr;
+
+	unsigned long long binarySize = 0;
+
+	fromFile.read(reinterpret_cast<char*>(&binarySize), sizeof(binarySize));
+
+	if (!fromFile.good() || binarySize == 0)
+		return nullptr;
+
+	std::vector<unsigned char> binary(binarySize);
+
+	fromFile.read(reinterpret_cast<char*>(&binary[0]), binarySize);
+
+	if (!fromFile.good())
+		return nullptr;
+
+	cl::Program::Binaries binaries(1, std::make_pair(static_cast<const void*>(&binary[0]), static_cast<size_t>(binarySize)));
+
+	std::vector<cl_int> binaryStatus;
+	cl_int err;
+
+	std::shared_ptr<cl::Program> program(new cl::Program(context, std::vector<cl::Device>(1, device), binaries, &binaryStatus, &err));
+
+	// Stale or corrupt binaries are rebuilt from source
+	if (err != CL_SUCCESS || binaryStatus.empty() || binaryStatus[0] != CL_SUCCESS)
+		return nullptr;
+
+	if (program->build(std::vector<cl::Device>(1, device), options.c_str()) != CL_SUCCESS)
+		return nullptr;
+
+	return program;
+}
+
+void ProgramCache::saveBinary(const cl::Program &program, const std::string &diskKey, Logger &logger) {
+	std::vector<size_t> binarySizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+
+	// Only single device programs are built by the cache
+	if (binarySizes.size() != 1 || binarySizes[0] == 0)
+		return;
+
+	std::vector<unsigned char> binary(binarySizes[0]);
+
+	// Queried through the C API, since the destination buffers must be allocated by the caller
+	unsigned char* pBinary = &binary[0];
+
+	if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(unsigned char*), &pBinary, nullptr) != CL_SUCCESS)
+		return;
+
+	// Write to a temporary file first, so that an interrupted run never leaves a truncated entry
+	std::string fileName = getFileName(diskKey);
+	std::string tempFileName = fileName + ".tmp";
+
+	{
+		std::ofstream toFile(tempFileName, std::ios::binary);
+
+		// The directory is created on the first save
+		if (!toFile.is_open() && createDirectory(_directory))
+			toFile.open(tempFileName, std::ios::binary);
+
+		// Later saves try again, the failure may be temporary
+		if (!toFile.is_open()) {
+			logger << "Could not write program binary to \"" + tempFileName + "\"" + endl;
+
+			return;
+		}
+
+		unsigned long long keySize = diskKey.size();
+		unsigned long long binarySize = binary.size();
+
+		toFile.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+		toFile.write(diskKey.data(), keySize);
+		toFile.write(reinterpret_cast<const char*>(&binarySize), sizeof(binarySize));
+		toFile.write(reinterpret_cast<const char*>(&binary[0]), binarySize);
+	}
+
+	std::remove(fileName.c_str());
+	std::rename(tempFileName.c_str(), fileName.c_str());
+}
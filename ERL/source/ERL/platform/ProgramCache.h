@@ -0,0 +1,162 @@
+/*
+ERL
+
+Program Cache
+*/
+
+#pragma once
+
+#include <erl/platform/Logger.h>
+#include <erl/platform/Uncopyable.h>
+#include <erl/platform/ThreadPool.h>
+#include <CL/cl.hpp>
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <future>
+#include <mutex>
+
+namespace erl {
+	// Built programs keyed by their source and build options, so identical generated kernels are only built once.
+	// Least recently used programs are evicted when either limit is exceeded.
+	// With a directory set, program binaries are also stored on disk, keyed by device, driver, build options and source, so they survive restarts.
+	// Programs can be built ahead on background threads, get then waits for them instead of building again.
+	// Can be used from several threads, a program missed by several of them at once is only built once
+	class ProgramCache : public Uncopyable {
+	private:
+		struct Entry {
+			std::string _key;
+			std::shared_ptr<cl::Program> _program;
+
+			// Appended to the program scope names of the source when it was built as part of a batch
+			std::string _nameSuffix;
+
+			// Source plus binary size
+			size_t _size;
+		};
+
+		// Program being built, on a background thread when built ahead, otherwise on the thread that missed it, which first tries the disk.
+		// Loads and builds run outside the lock, other threads that need the program wait for them
+		class BuildItem : public ThreadPool::WorkItem {
+		public:
+			cl::Context _context;
+			cl::Device _device;
+			std::string _source;
+			std::string _options;
+
+			std::shared_ptr<cl::Program> _program;
+			bool _built;
+			bool _loadedFromDisk;
+
+			// Queued by buildAhead, rather than by a get that waits for it
+			bool _builtAhead;
+
+			// Set once the build is done, whether it succeeded or not
+			std::promise<void> _finished;
+			std::shared_future<void> _finishedFuture;
+
+			BuildItem()
+				: _built(false), _loadedFromDisk(false), _builtAhead(false)
+			{
+				_finishedFuture = _finished.get_future();
+			}
+
+			void run(size_t threadIndex);
+		};
+
+		// Most recently used first
+		std::list<Entry> _entries;
+		std::unordered_map<std::string, std::list<Entry>::iterator> _keyToEntry;
+
+		// Programs being built ahead, by key
+		std::unordered_map<std::string, std::shared_ptr<BuildItem>> _keyToBuildItem;
+
+		ThreadPool _buildThreadPool;
+
+		// Recursive, since buildAhead checks contains while holding it
+		mutable std::recursive_mutex _mutex;
+
+		size_t _totalSize;
+
+		size_t _numHits;
+		size_t _numMisses;
+		size_t _numDiskHits;
+
+		void evict();
+
+		// Add a built program as the most recently used entry and evict. Expects the lock to be held
+		void addEntry(const std::string &key, const std::shared_ptr<cl::Program> &program);
+
+		// Name of the binary file of a disk key
+		std::string getFileName(const std::string &diskKey) const;
+
+		std::shared_ptr<cl::Program> loadBinary(cl::Context &context, cl::Device &device, const std::string &diskKey, const std::string &options);
+		void saveBinary(const cl::Program &program, const std::string &diskKey, Logger &logger);
+
+	public:
+		// Eviction limits, 0 for no limit
+		size_t _maxPrograms;
+		size_t _maxSize;
+
+		// Directory for program binaries, created on the first save if it does not exist. Empty to only cache in memory
+		std::string _directory;
+
+		// Threads for building ahead, started on the first buildAhead
+		size_t _numBuildThreads;
+
+		// Macro a batch defines to the suffix of each source's program scope names
+		static const char* const nameSuffixMacro;
+
+		// Preprocessor block that suffixes the given program scope names with nameSuffixMacro when it is defined, to put at the start of a source
+		static std::string programScopeNamesToCL(const std::vector<std::string> &names);
+
+		ProgramCache()
+			: _totalSize(0), _numHits(0), _numMisses(0), _numDiskHits(0), _maxPrograms(512), _maxSize(256 * 1024 * 1024), _numBuildThreads(2)
+		{}
+
+		// Get a built program, building it on a miss. Returns nullptr and logs the build log if building fails.
+		// Callers that pass pNameSuffix also accept programs built in a batch, and must append the suffix to the kernel names they look up
+		std::shared_ptr<cl::Program> get(cl::Context &context, cl::Device &device, const std::string &source, const std::string &options, Logger &logger, std::string* pNameSuffix = nullptr);
+
+		// Build all sources that are not cached yet as a single program, to pay the build overhead once.
+		// Each source is built with nameSuffixMacro defined to a unique suffix, so sources must declare their program scope names through programScopeNamesToCL.
+		// Batches are only cached in memory, since their binary can not be split per source. Sources whose binary is already on disk are left out of the batch.
+		// The build runs outside the cache lock. A source requested through get meanwhile is built on its own, and keeps that program
+		void buildBatch(cl::Context &context, cl::Device &device, const std::vector<std::string> &sources, const std::string &options, Logger &logger);
+
+		// Start building a program on a background thread, unless it is cached or already being built. Does not wait for the build
+		void buildAhead(cl::Context &context, cl::Device &device, const std::string &source, const std::string &options);
+
+		// Move programs that finished building ahead but were never fetched through get into the cache, so they are counted and evicted like the others.
+		// Builds that are still running are left for a later call
+		void storeBuiltAhead(Logger &logger);
+
+		// Whether get would not have to build the program, because it is in memory, its binary is on disk or it is being built ahead
+		bool contains(cl::Device &device, const std::string &source, const std::string &options) const;
+
+		void clear();
+
+		size_t getNumPrograms() const {
+			return _entries.size();
+		}
+
+		size_t getTotalSize() const {
+			return _totalSize;
+		}
+
+		size_t getNumHits() const {
+			return _numHits;
+		}
+
+		size_t getNumMisses() const {
+			return _numMisses;
+		}
+
+		// Misses that were loaded from disk instead of built
+		size_t getNumDiskHits() const {
+			return _numDiskHits;
+		}
+	};
+}
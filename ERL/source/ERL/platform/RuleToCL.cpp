@@ -1,5 +1,8 @@
 #include <erl/platform/RuleToCL.h>
 
+#include <algorithm>
+#include <cmath>
+
 using namespace erl;
 
 struct ConnectionDesc {
@@ -17,87 +20,63 @@ struct ConnectionDesc {
 	}
 };
 
-std::string getOutputNodeString(ne::Phenotype &phenotype, const std::vector<std::vector<size_t>> &outgoingConnectionsInput, const std::vector<std::vector<size_t>> &outgoingConnectionsRecurrentIntermediate, std::unordered_set<ConnectionDesc, ConnectionDesc> &data,
-	const std::vector<std::string> &functionNames, std::vector<bool> &calculatedIntermediates, int nodeIndex);
+// Literal, or the next entry of the weight buffer if weights are not baked into the source
+std::string weightToCL(float weight, std::vector<float>* pWeights) {
+	if (pWeights == nullptr)
+		return std::to_string(weight) + "f";
 
-void floodForwardCalculateIntermediates(std::list<int> &openList, ne::Phenotype &phenotype, const std::vector<std::vector<size_t>> &outgoingConnectionsInput, const std::vector<std::vector<size_t>> &outgoingConnectionsRecurrentIntermediate, std::unordered_set<ConnectionDesc, ConnectionDesc> &data,
-	const std::vector<std::string> &functionNames, std::vector<bool> &calculatedIntermediates, std::string &outputCode)
-{
-	int nodeIndex = openList.front();
+	pWeights->push_back(weight);
 
-	openList.pop_front();
+	return "weights[" + std::to_string(pWeights->size() - 1) + "]";
+}
 
-	// If is intermediate, compute it
-	if (nodeIndex >= 0) {
-		std::shared_ptr<ne::Phenotype::Node> neuron = phenotype.getNodes()[nodeIndex];
+// Connections that read recurrent values (data), and the outgoing connections of inputs and of nodes
+void calculateConnectionData(ne::Phenotype &phenotype, std::unordered_set<ConnectionDesc, ConnectionDesc> &data, std::vector<std::vector<size_t>> &outgoingConnectionsInput, std::vector<std::vector<size_t>> &outgoingConnectionsRecurrentIntermediate) {
+	size_t numNodes = phenotype.getNodes().size();
 
-		size_t numNonRecurrentOutgoingConnections = 0;
+	outgoingConnectionsInput.resize(phenotype.getNumInputs());
+	outgoingConnectionsRecurrentIntermediate.resize(numNodes);
 
-		for (size_t i = 0; i < outgoingConnectionsRecurrentIntermediate[nodeIndex].size(); i++) {
+	for (size_t i = 0; i < numNodes; i++) {
+		std::shared_ptr<ne::Phenotype::Node> neuron = phenotype.getNodes()[i];
+
+		for (size_t j = 0; j < neuron->_connections.size(); j++) {
 			ConnectionDesc cd;
 
-			cd._inIndex = nodeIndex;
-			cd._outIndex = outgoingConnectionsRecurrentIntermediate[nodeIndex][i];
+			cd._inIndex = neuron->_connections[j]._fetchIndex;
+			cd._outIndex = i;
 
-			if (data.find(cd) == data.end())
-				numNonRecurrentOutgoingConnections++;
+			if (neuron->_connections[j]._fetchType == ne::Phenotype::_input)
+				outgoingConnectionsInput[cd._inIndex].push_back(i);
+			else
+				outgoingConnectionsRecurrentIntermediate[cd._inIndex].push_back(i);
 		}
+	}
 
-		if (numNonRecurrentOutgoingConnections >= 2) { //  || neuron._inputs.empty()
-			if (!calculatedIntermediates[nodeIndex]) {
-				outputCode += "	float intermediate" + std::to_string(nodeIndex) + " = ";
+	std::unordered_set<size_t> recurrentSourceNodesSet;
 
-				for (size_t i = 0; i < neuron->_connections.size(); i++) {
-					const ne::Phenotype::Connection &c = neuron->_connections[i];
-					ConnectionDesc cd;
+	for (size_t i = 0; i < phenotype.getRecurrentNodeIndices().size(); i++)
+		recurrentSourceNodesSet.insert(phenotype.getRecurrentNodeIndices()[i]);
 
-					cd._inIndex = c._fetchIndex;
-					cd._outIndex = nodeIndex;
+	for (size_t n = 0; n < numNodes; n++) {
+		for (size_t c = 0; c < phenotype.getNodes()[n]->_connections.size(); c++) {
+			const ne::Phenotype::Connection &connection = phenotype.getNodes()[n]->_connections[c];
 
-					std::unordered_set<ConnectionDesc, ConnectionDesc>::iterator it = data.find(cd);
+			if (connection._fetchType != ne::Phenotype::_input) {
+				if (recurrentSourceNodesSet.find(connection._fetchIndex) != recurrentSourceNodesSet.end()) {
+					ConnectionDesc cd;
 
-					if (it == data.end()) // Not recurrent connection
-						outputCode += std::to_string(neuron->_connections[i]._weight) + "f * " + getOutputNodeString(phenotype, outgoingConnectionsInput, outgoingConnectionsRecurrentIntermediate, data, functionNames, calculatedIntermediates, neuron->_connections[i]._fetchType == ne::Phenotype::_input ? -static_cast<int>(neuron->_connections[i]._fetchIndex) - 1 : neuron->_connections[i]._fetchIndex);
-					else
-						outputCode += std::to_string(neuron->_connections[i]._weight) + "f * (*recurrent" + std::to_string(neuron->_connections[i]._fetchIndex) + ")";
+					cd._inIndex = connection._fetchIndex;
+					cd._outIndex = n;
 
-					//if (i != neuron._inputs.size() - 1)
-					outputCode += " + ";
+					data.insert(cd);
 				}
-
-				outputCode += std::to_string(neuron->_bias) + "f";
-
-				outputCode += ";\n";
-
-				calculatedIntermediates[nodeIndex] = true;
 			}
 		}
-
-		for (size_t i = 0; i < outgoingConnectionsRecurrentIntermediate[nodeIndex].size(); i++) {
-			// Don't follow recurrent connections
-			ConnectionDesc cd;
-
-			cd._inIndex = nodeIndex;
-			cd._outIndex = outgoingConnectionsRecurrentIntermediate[nodeIndex][i];
-
-			if (data.find(cd) == data.end())
-				openList.push_back(outgoingConnectionsRecurrentIntermediate[nodeIndex][i]);
-		}
-	}
-	else {
-		size_t inputIndex = -nodeIndex - 1;
-
-		for (size_t i = 0; i < outgoingConnectionsInput[inputIndex].size(); i++)
-			openList.push_back(outgoingConnectionsInput[inputIndex][i]);
 	}
 }
 
-std::string getOutputNodeString(ne::Phenotype &phenotype, const std::vector<std::vector<size_t>> &outgoingConnectionsInput, const std::vector<std::vector<size_t>> &outgoingConnectionsRecurrentIntermediate, std::unordered_set<ConnectionDesc, ConnectionDesc> &data,
-	const std::vector<std::string> &functionNames, std::vector<bool> &calculatedIntermediates, int nodeIndex)
-{
-	if (nodeIndex < 0)
-		return "input" + std::to_string(-nodeIndex - 1);
-
+size_t getNumNonRecurrentOutgoingConnections(const std::vector<std::vector<size_t>> &outgoingConnectionsRecurrentIntermediate, std::unordered_set<ConnectionDesc, ConnectionDesc> &data, int nodeIndex) {
 	size_t numNonRecurrentOutgoingConnections = 0;
 
 	for (size_t i = 0; i < outgoingConnectionsRecurrentIntermediate[nodeIndex].size(); i++) {
@@ -110,90 +89,319 @@ std::string getOutputNodeString(ne::Phenotype &phenotype, const std::vector<std:
 			numNonRecurrentOutgoingConnections++;
 	}
 
-	// If needs intermediate storage
-	if (numNonRecurrentOutgoingConnections >= 2 && calculatedIntermediates[nodeIndex])
-		return "intermediate" + std::to_string(nodeIndex);
+	return numNonRecurrentOutgoingConnections;
+}
 
-	std::shared_ptr<ne::Phenotype::Node> neuron = phenotype.getNodes()[nodeIndex];
+// Value in the dataflow graph of a rule. Values are created after their operands, and identical values are only created once
+struct RuleValue {
+	enum Type {
+		_input, _recurrent, _constant, _sum, _activation
+	};
 
-	std::string sub = "";
+	Type _type;
 
-	for (size_t i = 0; i < neuron->_connections.size(); i++) {
-		ConnectionDesc cd;
-		cd._inIndex = neuron->_connections[i]._fetchIndex;
-		cd._outIndex = nodeIndex;
+	// Input index, recurrent position (in getRecurrentNodeIndices) or activation function index
+	int _index;
+
+	// Constant, or bias of a sum
+	float _scalar;
+
+	// Weighted operands of a sum, or the operand of an activation (with weight 1)
+	std::vector<std::pair<float, int>> _operands;
+
+	RuleValue(Type type, int index, float scalar)
+		: _type(type), _index(index), _scalar(scalar)
+	{}
+};
+
+// All values of a rule. Recurrents are read as they were before the rule and written at its end, after the outputs
+struct RuleGraph {
+	std::vector<RuleValue> _values;
+	std::unordered_map<std::string, int> _valueIndices;
+
+	// Values written to the outputs and recurrents
+	std::vector<int> _outputs;
+	std::vector<int> _recurrents;
+
+	// Number of uses by live values and roots. Sums and activations used more than once are computed into a temporary, others are inlined.
+	// Recurrent roots always are, so no recurrent is written before the values that read it
+	std::vector<int> _numUses;
+	std::vector<bool> _materialized;
+};
+
+int addRuleValue(RuleGraph &graph, const RuleValue &value) {
+	// Keyed on the exact bits of the weights, so only identical values are shared
+	std::string key(1, static_cast<char>(value._type));
+
+	key.append(reinterpret_cast<const char*>(&value._index), sizeof(int));
+	key.append(reinterpret_cast<const char*>(&value._scalar), sizeof(float));
+
+	for (size_t i = 0; i < value._operands.size(); i++) {
+		key.append(reinterpret_cast<const char*>(&value._operands[i].first), sizeof(float));
+		key.append(reinterpret_cast<const char*>(&value._operands[i].second), sizeof(int));
+	}
+
+	std::unordered_map<std::string, int>::iterator it = graph._valueIndices.find(key);
+
+	if (it != graph._valueIndices.end())
+		return it->second;
+
+	graph._values.push_back(value);
+
+	graph._valueIndices[key] = graph._values.size() - 1;
+
+	return graph._values.size() - 1;
+}
 
-		std::unordered_set<ConnectionDesc, ConnectionDesc>::iterator it = data.find(cd);
+// Weighted sum plus bias. Constant operands are folded into the bias
+int sumToGraph(RuleGraph &graph, const std::vector<std::pair<float, int>> &operands, float bias) {
+	RuleValue sum(RuleValue::_sum, 0, bias);
 
-		if (it == data.end()) // Not recurrent connection
-			sub += std::to_string(neuron->_connections[i]._weight) + "f * " + getOutputNodeString(phenotype, outgoingConnectionsInput, outgoingConnectionsRecurrentIntermediate, data, functionNames, calculatedIntermediates, neuron->_connections[i]._fetchType == ne::Phenotype::_input ? -static_cast<int>(neuron->_connections[i]._fetchIndex) - 1 : neuron->_connections[i]._fetchIndex);
+	float constantSum = 0.0f;
+	bool hasConstants = false;
+
+	for (size_t i = 0; i < operands.size(); i++) {
+		const RuleValue &operand = graph._values[operands[i].second];
+
+		if (operand._type == RuleValue::_constant) {
+			constantSum += operands[i].first * operand._scalar;
+
+			hasConstants = true;
+		}
 		else
-			sub += std::to_string(neuron->_connections[i]._weight) + "f * (*recurrent" + std::to_string(neuron->_connections[i]._fetchIndex) + ")";
+			sum._operands.push_back(operands[i]);
+	}
+
+	if (hasConstants)
+		sum._scalar = constantSum + bias;
+
+	if (sum._operands.empty())
+		return addRuleValue(graph, RuleValue(RuleValue::_constant, 0, sum._scalar));
+
+	return addRuleValue(graph, sum);
+}
+
+// State of building the graph of a rule. Follows the evaluation of the original expression emitter: intermediates are found by flooding forward from the inputs
+// and stored as sums (without activation), other nodes are evaluated where they are used, and recurrents are updated in order
+struct RuleGraphBuilder {
+	ne::Phenotype* _pPhenotype;
 
-		//if (i != neuron._inputs.size() - 1)
-			sub += " + ";
+	std::unordered_set<ConnectionDesc, ConnectionDesc> _data;
+	std::vector<std::vector<size_t>> _outgoingConnectionsInput;
+	std::vector<std::vector<size_t>> _outgoingConnectionsRecurrentIntermediate;
+
+	// Round weights to the literals ruleToCL emits without a weight buffer
+	bool _literalWeights;
+
+	// Value of each node that was computed as an intermediate, -1 if it was not (yet)
+	std::vector<int> _intermediates;
+
+	// Current value of each recurrent node, by node index
+	std::vector<int> _recurrentValues;
+
+	RuleGraph* _pGraph;
+
+	float getWeight(float weight) const {
+		if (_literalWeights)
+			return std::stof(std::to_string(weight));
+
+		return weight;
 	}
+};
+
+int nodeValueToGraph(RuleGraphBuilder &builder, int nodeIndex);
+
+int nodeSumToGraph(RuleGraphBuilder &builder, int nodeIndex) {
+	std::shared_ptr<ne::Phenotype::Node> neuron = builder._pPhenotype->getNodes()[nodeIndex];
 
-	sub += std::to_string(neuron->_bias) + "f";
+	std::vector<std::pair<float, int>> operands;
 
-	return functionNames[neuron->_functionIndex] + "(" + sub + ")";
+	for (size_t i = 0; i < neuron->_connections.size(); i++) {
+		const ne::Phenotype::Connection &c = neuron->_connections[i];
+
+		float weight = builder.getWeight(c._weight);
+
+		// Effectively zero, drop the edge
+		if (std::abs(weight) < ruleMinWeight)
+			continue;
+
+		ConnectionDesc cd;
+
+		cd._inIndex = c._fetchIndex;
+		cd._outIndex = nodeIndex;
+
+		if (builder._data.find(cd) == builder._data.end()) // Not recurrent connection
+			operands.push_back(std::make_pair(weight, nodeValueToGraph(builder, c._fetchType == ne::Phenotype::_input ? -static_cast<int>(c._fetchIndex) - 1 : c._fetchIndex)));
+		else
+			operands.push_back(std::make_pair(weight, builder._recurrentValues[c._fetchIndex]));
+	}
+
+	return sumToGraph(*builder._pGraph, operands, builder.getWeight(neuron->_bias));
 }
 
-std::string erl::ruleToCL(ne::Phenotype &phenotype,
-	const std::string &ruleName, const std::vector<std::string> &functionNames)
-{
-	size_t numNodes = phenotype.getNodes().size();
-	size_t numHidden = numNodes - phenotype.getNumOutputs();
+int nodeValueToGraph(RuleGraphBuilder &builder, int nodeIndex) {
+	if (nodeIndex < 0)
+		return addRuleValue(*builder._pGraph, RuleValue(RuleValue::_input, -nodeIndex - 1, 0.0f));
 
-	size_t numRecurrentNodes = 0;
+	// If has intermediate storage
+	if (getNumNonRecurrentOutgoingConnections(builder._outgoingConnectionsRecurrentIntermediate, builder._data, nodeIndex) >= 2 && builder._intermediates[nodeIndex] != -1)
+		return builder._intermediates[nodeIndex];
 
-	// Calculate connection data set and outgoing connections
-	std::unordered_set<ConnectionDesc, ConnectionDesc> data;
-	std::vector<std::vector<size_t>> outgoingConnectionsInput;
-	std::vector<std::vector<size_t>> outgoingConnectionsRecurrentIntermediate;
+	RuleValue activation(RuleValue::_activation, builder._pPhenotype->getNodes()[nodeIndex]->_functionIndex, 0.0f);
 
-	outgoingConnectionsInput.resize(phenotype.getNumInputs());
-	outgoingConnectionsRecurrentIntermediate.resize(numNodes);
+	activation._operands.push_back(std::make_pair(1.0f, nodeSumToGraph(builder, nodeIndex)));
 
-	for (size_t i = 0; i < numNodes; i++) {
-		std::shared_ptr<ne::Phenotype::Node> neuron = phenotype.getNodes()[i];
+	return addRuleValue(*builder._pGraph, activation);
+}
 
-		for (size_t j = 0; j < neuron->_connections.size(); j++) {
+void floodForwardIntermediatesToGraph(std::list<int> &openList, RuleGraphBuilder &builder) {
+	int nodeIndex = openList.front();
+
+	openList.pop_front();
+
+	// If is intermediate, compute it
+	if (nodeIndex >= 0) {
+		if (getNumNonRecurrentOutgoingConnections(builder._outgoingConnectionsRecurrentIntermediate, builder._data, nodeIndex) >= 2 && builder._intermediates[nodeIndex] == -1)
+			builder._intermediates[nodeIndex] = nodeSumToGraph(builder, nodeIndex);
+
+		for (size_t i = 0; i < builder._outgoingConnectionsRecurrentIntermediate[nodeIndex].size(); i++) {
+			// Don't follow recurrent connections
 			ConnectionDesc cd;
 
-			cd._inIndex = neuron->_connections[j]._fetchIndex;
-			cd._outIndex = i;
+			cd._inIndex = nodeIndex;
+			cd._outIndex = builder._outgoingConnectionsRecurrentIntermediate[nodeIndex][i];
 
-			if (neuron->_connections[j]._fetchType == ne::Phenotype::_input)
-				outgoingConnectionsInput[cd._inIndex].push_back(i);
-			else
-				outgoingConnectionsRecurrentIntermediate[cd._inIndex].push_back(i);
+			if (builder._data.find(cd) == builder._data.end())
+				openList.push_back(builder._outgoingConnectionsRecurrentIntermediate[nodeIndex][i]);
 		}
 	}
+	else {
+		size_t inputIndex = -nodeIndex - 1;
 
-	std::unordered_set<size_t> recurrentSourceNodesSet;
+		for (size_t i = 0; i < builder._outgoingConnectionsInput[inputIndex].size(); i++)
+			openList.push_back(builder._outgoingConnectionsInput[inputIndex][i]);
+	}
+}
+
+void phenotypeToRuleGraph(ne::Phenotype &phenotype, bool literalWeights, RuleGraph &graph) {
+	size_t numNodes = phenotype.getNodes().size();
+
+	RuleGraphBuilder builder;
+
+	builder._pPhenotype = &phenotype;
+	builder._literalWeights = literalWeights;
+	builder._intermediates.assign(numNodes, -1);
+	builder._recurrentValues.assign(numNodes, -1);
+	builder._pGraph = &graph;
+
+	calculateConnectionData(phenotype, builder._data, builder._outgoingConnectionsInput, builder._outgoingConnectionsRecurrentIntermediate);
 
 	for (size_t i = 0; i < phenotype.getRecurrentNodeIndices().size(); i++)
-		recurrentSourceNodesSet.insert(phenotype.getRecurrentNodeIndices()[i]);
+		builder._recurrentValues[phenotype.getRecurrentNodeIndices()[i]] = addRuleValue(graph, RuleValue(RuleValue::_recurrent, i, 0.0f));
 
-	for (size_t n = 0; n < numNodes; n++) {
-		for (size_t c = 0; c < phenotype.getNodes()[n]->_connections.size(); c++) {
-			const ne::Phenotype::Connection &connection = phenotype.getNodes()[n]->_connections[c];
+	// Compute all intermediates
+	for (size_t i = 0; i < phenotype.getNumInputs(); i++) {
+		std::list<int> openList;
 
-			if (connection._fetchType != ne::Phenotype::_input) {
-				if (recurrentSourceNodesSet.find(connection._fetchIndex) != recurrentSourceNodesSet.end()) {
-					ConnectionDesc cd;
+		openList.push_back(-static_cast<int>(i) - 1);
 
-					cd._inIndex = connection._fetchIndex;
-					cd._outIndex = n;
+		while (!openList.empty())
+			floodForwardIntermediatesToGraph(openList, builder);
+	}
 
-					data.insert(cd);
-				}
-			}
-		}
+	for (size_t i = 0; i < numNodes; i++)
+	if (phenotype.getNodes()[i]->_connections.empty()) {
+		std::list<int> openList;
+
+		openList.push_back(i);
+
+		while (!openList.empty())
+			floodForwardIntermediatesToGraph(openList, builder);
+	}
+
+	// Compute all outputs
+	for (size_t i = 0; i < phenotype.getNumOutputs(); i++)
+		graph._outputs.push_back(nodeValueToGraph(builder, i));
+
+	// Update recurrents, later ones see the new values of earlier ones
+	for (size_t i = 0; i < phenotype.getRecurrentNodeIndices().size(); i++) {
+		graph._recurrents.push_back(nodeValueToGraph(builder, phenotype.getRecurrentNodeIndices()[i]));
+
+		builder._recurrentValues[phenotype.getRecurrentNodeIndices()[i]] = graph._recurrents.back();
+	}
+
+	// Count uses of live values, operands always come before their users. Values that reach no output or recurrent are dropped
+	graph._numUses.assign(graph._values.size(), 0);
+	graph._materialized.assign(graph._values.size(), false);
+
+	for (size_t i = 0; i < graph._outputs.size(); i++)
+		graph._numUses[graph._outputs[i]]++;
+
+	for (size_t i = 0; i < graph._recurrents.size(); i++)
+		graph._numUses[graph._recurrents[i]]++;
+
+	for (int v = static_cast<int>(graph._values.size()) - 1; v >= 0; v--)
+	if (graph._numUses[v] > 0) {
+		for (size_t i = 0; i < graph._values[v]._operands.size(); i++)
+			graph._numUses[graph._values[v]._operands[i].second]++;
+	}
+
+	for (size_t v = 0; v < graph._values.size(); v++)
+		graph._materialized[v] = graph._numUses[v] >= 2 && (graph._values[v]._type == RuleValue::_sum || graph._values[v]._type == RuleValue::_activation);
+
+	for (size_t i = 0; i < graph._recurrents.size(); i++)
+		graph._materialized[graph._recurrents[i]] = graph._values[graph._recurrents[i]]._type == RuleValue::_sum || graph._values[graph._recurrents[i]]._type == RuleValue::_activation;
+}
+
+std::string ruleExpressionToCL(ne::Phenotype &phenotype, const RuleGraph &graph, const std::vector<std::string> &functionNames, int valueIndex, std::vector<float>* pWeights);
+
+std::string ruleValueToCL(ne::Phenotype &phenotype, const RuleGraph &graph, const std::vector<std::string> &functionNames, int valueIndex, std::vector<float>* pWeights) {
+	if (graph._materialized[valueIndex])
+		return "value" + std::to_string(valueIndex);
+
+	// Inlined sums are operands of products
+	if (graph._values[valueIndex]._type == RuleValue::_sum)
+		return "(" + ruleExpressionToCL(phenotype, graph, functionNames, valueIndex, pWeights) + ")";
+
+	return ruleExpressionToCL(phenotype, graph, functionNames, valueIndex, pWeights);
+}
+
+std::string ruleExpressionToCL(ne::Phenotype &phenotype, const RuleGraph &graph, const std::vector<std::string> &functionNames, int valueIndex, std::vector<float>* pWeights) {
+	const RuleValue &value = graph._values[valueIndex];
+
+	switch (value._type) {
+	case RuleValue::_input:
+		return "input" + std::to_string(value._index);
+	case RuleValue::_recurrent:
+		return "(*recurrent" + std::to_string(phenotype.getRecurrentNodeIndices()[value._index]) + ")";
+	case RuleValue::_constant:
+		return weightToCL(value._scalar, pWeights);
+	case RuleValue::_activation:
+		return functionNames[value._index] + "(" + ruleValueToCL(phenotype, graph, functionNames, value._operands[0].second, pWeights) + ")";
+	default:
+		break;
+	}
+
+	std::string sum = "";
+
+	for (size_t i = 0; i < value._operands.size(); i++) {
+		sum += weightToCL(value._operands[i].first, pWeights);
+
+		sum += " * " + ruleValueToCL(phenotype, graph, functionNames, value._operands[i].second, pWeights) + " + ";
 	}
 
-	// Do not include inputs in recurrent node count
+	sum += weightToCL(value._scalar, pWeights);
+
+	return sum;
+}
+
+std::string erl::ruleToCL(ne::Phenotype &phenotype,
+	const std::string &ruleName, const std::vector<std::string> &functionNames, std::vector<float>* pWeights)
+{
+	RuleGraph graph;
+
+	phenotypeToRuleGraph(phenotype, pWeights == nullptr, graph);
+
 	std::string code;
 
 	code += "void " + ruleName + "(";
@@ -204,13 +412,8 @@ std::string erl::ruleToCL(ne::Phenotype &phenotype,
 	}
 
 	// Outputs
-	size_t outputsStart = numHidden;
-
 	for (size_t i = 0; i < phenotype.getNumOutputs(); i++) {
 		code += "float* output" + std::to_string(i) + ", ";
-		
-		//if (numRecurrentNodes != 0 || i != phenotype.getNumOutputs() - 1)
-		//	code += ", ";
 	}
 
 	// Recurrent
@@ -220,49 +423,316 @@ std::string erl::ruleToCL(ne::Phenotype &phenotype,
 		code += ", ";
 	}
 
+	// Weights and biases
+	if (pWeights != nullptr)
+		code += "constant float* weights, ";
+
 	// Erase last 2 characters, which are ", "
 	code.pop_back();
 	code.pop_back();
 
 	code += ") {\n";
 
-	std::vector<bool> calculatedIntermediates(numNodes, false);
+	// Temporaries
+	for (size_t v = 0; v < graph._values.size(); v++)
+	if (graph._materialized[v])
+		code += "	float value" + std::to_string(v) + " = " + ruleExpressionToCL(phenotype, graph, functionNames, v, pWeights) + ";\n";
 
-	// Compute all intermediates
-	for (size_t i = 0; i < phenotype.getNumInputs(); i++) {
-		int startIndex = -static_cast<int>(i)-1;
+	// Outputs
+	for (size_t i = 0; i < graph._outputs.size(); i++)
+		code += "	(*output" + std::to_string(i) + ") = " + ruleValueToCL(phenotype, graph, functionNames, graph._outputs[i], pWeights) + ";\n";
 
-		std::list<int> openList;
+	// Update recurrents
+	for (size_t i = 0; i < graph._recurrents.size(); i++)
+		code += "	(*recurrent" + std::to_string(phenotype.getRecurrentNodeIndices()[i]) + ") = " + ruleValueToCL(phenotype, graph, functionNames, graph._recurrents[i], pWeights) + ";\n";
 
-		openList.push_back(startIndex);
+	code += "}\n";
 
-		while (!openList.empty())
-			floodForwardCalculateIntermediates(openList, phenotype, outgoingConnectionsInput, outgoingConnectionsRecurrentIntermediate, data, functionNames, calculatedIntermediates, code);
+	return code;
+}
+
+std::vector<bool> erl::getRuleInputsUsed(ne::Phenotype &phenotype, bool weightsInBuffer) {
+	RuleGraph graph;
+
+	phenotypeToRuleGraph(phenotype, !weightsInBuffer, graph);
+
+	std::vector<bool> inputsUsed(phenotype.getNumInputs(), false);
+
+	for (size_t v = 0; v < graph._values.size(); v++)
+	if (graph._values[v]._type == RuleValue::_input && graph._numUses[v] > 0)
+		inputsUsed[graph._values[v]._index] = true;
+
+	return inputsUsed;
+}
+
+// Bytecode being emitted for one rule
+struct RuleBytecode {
+	std::vector<int>* _pCode;
+	std::vector<float>* _pWeights;
+
+	// Intermediate slot of each materialized value
+	std::vector<int> _slots;
+
+	int _stackSize;
+	int _maxStackSize;
+
+	void emit(RuleOpcode opcode, int operand) {
+		_pCode->push_back(static_cast<int>(opcode) | (operand << 8));
+
+		switch (opcode) {
+		case _pushInput:
+		case _pushRecurrent:
+		case _pushIntermediate:
+		case _pushWeight:
+			_stackSize++;
+
+			break;
+		case _add:
+		case _storeIntermediate:
+		case _storeOutput:
+		case _storeRecurrent:
+			_stackSize--;
+
+			break;
+		default:
+			break;
+		}
+
+		_maxStackSize = std::max(_maxStackSize, _stackSize);
 	}
 
-	for (size_t i = 0; i < numNodes; i++)
-	if (phenotype.getNodes()[i]->_connections.empty()) {
-		int startIndex = i;
+	void emitWeight(RuleOpcode opcode, float weight) {
+		_pWeights->push_back(weight);
 
-		std::list<int> openList;
+		emit(opcode, _pWeights->size() - 1);
+	}
+};
 
-		openList.push_back(startIndex);
+void ruleExpressionToBytecode(const RuleGraph &graph, RuleBytecode &bytecode, int valueIndex);
 
-		while (!openList.empty())
-			floodForwardCalculateIntermediates(openList, phenotype, outgoingConnectionsInput, outgoingConnectionsRecurrentIntermediate, data, functionNames, calculatedIntermediates, code);
+void ruleValueToBytecode(const RuleGraph &graph, RuleBytecode &bytecode, int valueIndex) {
+	if (graph._materialized[valueIndex])
+		bytecode.emit(_pushIntermediate, bytecode._slots[valueIndex]);
+	else
+		ruleExpressionToBytecode(graph, bytecode, valueIndex);
+}
+
+// Same operation order as ruleExpressionToCL
+void ruleExpressionToBytecode(const RuleGraph &graph, RuleBytecode &bytecode, int valueIndex) {
+	const RuleValue &value = graph._values[valueIndex];
+
+	switch (value._type) {
+	case RuleValue::_input:
+		bytecode.emit(_pushInput, value._index);
+
+		break;
+	case RuleValue::_recurrent:
+		bytecode.emit(_pushRecurrent, value._index);
+
+		break;
+	case RuleValue::_constant:
+		bytecode.emitWeight(_pushWeight, value._scalar);
+
+		break;
+	case RuleValue::_activation:
+		ruleValueToBytecode(graph, bytecode, value._operands[0].second);
+
+		bytecode.emit(_apply, value._index);
+
+		break;
+	case RuleValue::_sum:
+		for (size_t i = 0; i < value._operands.size(); i++) {
+			ruleValueToBytecode(graph, bytecode, value._operands[i].second);
+
+			bytecode.emitWeight(_multiplyWeight, value._operands[i].first);
+
+			if (i != 0)
+				bytecode.emit(_add, 0);
+		}
+
+		bytecode.emitWeight(_addWeight, value._scalar);
+
+		break;
 	}
+}
 
-	// Compute all outputs
-	for (size_t i = 0; i < phenotype.getNumOutputs(); i++) {
-		code += "	(*output" + std::to_string(i) + ") = " + getOutputNodeString(phenotype, outgoingConnectionsInput, outgoingConnectionsRecurrentIntermediate, data, functionNames, calculatedIntermediates, i) + ";\n";
+// Records statement as the last use of the materialized values an expression reads
+void findLastUses(const RuleGraph &graph, int valueIndex, int statement, std::vector<int> &lastUses) {
+	const RuleValue &value = graph._values[valueIndex];
+
+	for (size_t i = 0; i < value._operands.size(); i++) {
+		if (graph._materialized[value._operands[i].second])
+			lastUses[value._operands[i].second] = statement;
+		else
+			findLastUses(graph, value._operands[i].second, statement, lastUses);
 	}
+}
 
-	// Update recurrents
-	for (size_t i = 0; i < phenotype.getRecurrentNodeIndices().size(); i++) {
-		code += "	(*recurrent" + std::to_string(phenotype.getRecurrentNodeIndices()[i]) + ") = " + getOutputNodeString(phenotype, outgoingConnectionsInput, outgoingConnectionsRecurrentIntermediate, data, functionNames, calculatedIntermediates, phenotype.getRecurrentNodeIndices()[i]) + ";\n";
+bool erl::ruleToBytecode(ne::Phenotype &phenotype, std::vector<int> &code, std::vector<float> &weights) {
+	RuleGraph graph;
+
+	phenotypeToRuleGraph(phenotype, false, graph);
+
+	// Statements are the temporaries in order, then the outputs and recurrents
+	std::vector<int> statements;
+
+	for (size_t v = 0; v < graph._values.size(); v++)
+	if (graph._materialized[v])
+		statements.push_back(v);
+
+	std::vector<int> roots = graph._outputs;
+
+	roots.insert(roots.end(), graph._recurrents.begin(), graph._recurrents.end());
+
+	std::vector<int> lastUses(graph._values.size(), -1);
+
+	for (size_t s = 0; s < statements.size(); s++)
+		findLastUses(graph, statements[s], s, lastUses);
+
+	for (size_t r = 0; r < roots.size(); r++) {
+		if (graph._materialized[roots[r]])
+			lastUses[roots[r]] = statements.size() + r;
+		else
+			findLastUses(graph, roots[r], statements.size() + r, lastUses);
+	}
+
+	RuleBytecode bytecode;
+
+	bytecode._pCode = &code;
+	bytecode._pWeights = &weights;
+	bytecode._slots.assign(graph._values.size(), -1);
+	bytecode._stackSize = 0;
+	bytecode._maxStackSize = 0;
+
+	// Reuse the slots of temporaries after their last use
+	std::vector<int> freeSlots;
+	int numSlots = 0;
+
+	for (size_t s = 0; s < statements.size(); s++) {
+		ruleExpressionToBytecode(graph, bytecode, statements[s]);
+
+		for (size_t v = 0; v < graph._values.size(); v++)
+		if (bytecode._slots[v] != -1 && lastUses[v] == static_cast<int>(s))
+			freeSlots.push_back(bytecode._slots[v]);
+
+		if (freeSlots.empty())
+			bytecode._slots[statements[s]] = numSlots++;
+		else {
+			bytecode._slots[statements[s]] = freeSlots.back();
+
+			freeSlots.pop_back();
+		}
+
+		bytecode.emit(_storeIntermediate, bytecode._slots[statements[s]]);
+	}
+
+	for (size_t i = 0; i < graph._outputs.size(); i++) {
+		ruleValueToBytecode(graph, bytecode, graph._outputs[i]);
+
+		bytecode.emit(_storeOutput, i);
 	}
 
+	for (size_t i = 0; i < graph._recurrents.size(); i++) {
+		ruleValueToBytecode(graph, bytecode, graph._recurrents[i]);
+
+		bytecode.emit(_storeRecurrent, i);
+	}
+
+	bytecode.emit(_end, 0);
+
+	return bytecode._maxStackSize <= ruleInterpreterStackSize && numSlots <= ruleInterpreterMaxIntermediates;
+}
+
+std::string erl::ruleInterpreterToCL(const std::vector<std::string> &functionNames) {
+	std::string code;
+
+	code +=
+		"float applyRuleFunction(int functionIndex, float x) {\n"
+		"	switch (functionIndex) {\n";
+
+	for (size_t i = 0; i < functionNames.size(); i++)
+		code += "	case " + std::to_string(i) + ": return " + functionNames[i] + "(x);\n";
+
+	code +=
+		"	}\n"
+		"\n"
+		"	return x;\n"
+		"}\n"
+		"\n"
+		"void interpretRule(constant int* code, constant float* weights, const float* inputs, float* outputs, float* recurrents) {\n"
+		"	float stack[" + std::to_string(ruleInterpreterStackSize) + "];\n"
+		"	float intermediates[" + std::to_string(ruleInterpreterMaxIntermediates) + "];\n"
+		"	int top = -1;\n"
+		"\n"
+		"	for (;;) {\n"
+		"		int instruction = *code++;\n"
+		"		int operand = instruction >> 8;\n"
+		"\n"
+		"		switch (instruction & 0xff) {\n"
+		"		case " + std::to_string(_pushInput) + ": stack[++top] = inputs[operand]; break;\n"
+		"		case " + std::to_string(_pushRecurrent) + ": stack[++top] = recurrents[operand]; break;\n"
+		"		case " + std::to_string(_pushIntermediate) + ": stack[++top] = intermediates[operand]; break;\n"
+		"		case " + std::to_string(_pushWeight) + ": stack[++top] = weights[operand]; break;\n"
+		"		case " + std::to_string(_multiplyWeight) + ": stack[top] = weights[operand] * stack[top]; break;\n"
+		"		case " + std::to_string(_add) + ": top--; stack[top] = stack[top] + stack[top + 1]; break;\n"
+		"		case " + std::to_string(_addWeight) + ": stack[top] = stack[top] + weights[operand]; break;\n"
+		"		case " + std::to_string(_apply) + ": stack[top] = applyRuleFunction(operand, stack[top]); break;\n"
+		"		case " + std::to_string(_storeIntermediate) + ": intermediates[operand] = stack[top--]; break;\n"
+		"		case " + std::to_string(_storeOutput) + ": outputs[operand] = stack[top--]; break;\n"
+		"		case " + std::to_string(_storeRecurrent) + ": recurrents[operand] = stack[top--]; break;\n"
+		"		default: return;\n"
+		"		}\n"
+		"	}\n"
+		"}\n";
+
+	return code;
+}
+
+std::string erl::ruleWrapperToCL(ne::Phenotype &phenotype, const std::string &ruleName, int ruleIndex) {
+	size_t numRecurrents = phenotype.getRecurrentNodeIndices().size();
+
+	std::string code;
+
+	code += "void " + ruleName + "(";
+
+	for (size_t i = 0; i < phenotype.getNumInputs(); i++)
+		code += "float input" + std::to_string(i) + ", ";
+
+	for (size_t i = 0; i < phenotype.getNumOutputs(); i++)
+		code += "float* output" + std::to_string(i) + ", ";
+
+	for (size_t i = 0; i < numRecurrents; i++)
+		code += "float* recurrent" + std::to_string(i) + ", ";
+
+	code += "constant float* weights, constant int* code) {\n";
+
+	// Private arrays can not be empty
+	code += "	float inputs[" + std::to_string(std::max<size_t>(1, phenotype.getNumInputs())) + "] = { ";
+
+	for (size_t i = 0; i < phenotype.getNumInputs(); i++)
+		code += "input" + std::to_string(i) + (i + 1 < phenotype.getNumInputs() ? ", " : " ");
+
+	if (phenotype.getNumInputs() == 0)
+		code += "0.0f ";
+
+	code +=
+		"};\n"
+		"	float outputs[" + std::to_string(std::max<size_t>(1, phenotype.getNumOutputs())) + "];\n"
+		"	float recurrents[" + std::to_string(std::max<size_t>(1, numRecurrents)) + "];\n"
+		"\n";
+
+	for (size_t i = 0; i < numRecurrents; i++)
+		code += "	recurrents[" + std::to_string(i) + "] = (*recurrent" + std::to_string(i) + ");\n";
+
+	code += "\n	interpretRule(code + code[" + std::to_string(ruleIndex) + "], weights, inputs, outputs, recurrents);\n\n";
+
+	for (size_t i = 0; i < phenotype.getNumOutputs(); i++)
+		code += "	(*output" + std::to_string(i) + ") = outputs[" + std::to_string(i) + "];\n";
+
+	for (size_t i = 0; i < numRecurrents; i++)
+		code += "	(*recurrent" + std::to_string(i) + ") = recurrents[" + std::to_string(i) + "];\n";
+
 	code += "}\n";
 
 	return code;
-}
\ No newline at end of file
+}
@@ -10,6 +10,37 @@ Rule to OpenCL
 #include <string>
 
 namespace erl {
+	// Connections with smaller weights are dropped. Literal weights have 6 decimals, so these were multiplications by zero
+	const float ruleMinWeight = 0.0000005f;
+
+	// The rule is built as a graph of values: identical subexpressions are computed once, constant operands are folded, near-zero connections are dropped
+	// and nodes that reach no output or recurrent are removed. Values used more than once are stored in temporaries.
+	// With pWeights, weights and biases are appended to it and read from a constant weights parameter instead of being emitted as literals,
+	// so the source only depends on the rule topology
 	std::string ruleToCL(ne::Phenotype &phenotype,
-		const std::string &ruleName, const std::vector<std::string> &functionNames);
+		const std::string &ruleName, const std::vector<std::string> &functionNames, std::vector<float>* pWeights = nullptr);
+
+	// Which inputs of the rule generated by ruleToCL (with or without pWeights) reach an output or recurrent
+	std::vector<bool> getRuleInputsUsed(ne::Phenotype &phenotype, bool weightsInBuffer);
+
+	// Rule bytecode for the interpreter. An instruction is opcode | (operand << 8), values are kept on a stack
+	enum RuleOpcode {
+		_pushInput, _pushRecurrent, _pushIntermediate, _pushWeight, _multiplyWeight, _add, _addWeight, _apply,
+		_storeIntermediate, _storeOutput, _storeRecurrent, _end
+	};
+
+	// Interpreter limits, rules that exceed them can not be interpreted
+	const int ruleInterpreterStackSize = 32;
+	const int ruleInterpreterMaxIntermediates = 64;
+
+	// Appends the bytecode of a rule to code and its weights and biases to weights, evaluating the same graph in the same order as ruleToCL.
+	// Recurrent operands index getRecurrentNodeIndices. Returns false if the rule exceeds the interpreter limits
+	bool ruleToBytecode(ne::Phenotype &phenotype, std::vector<int> &code, std::vector<float> &weights);
+
+	// Declares interpretRule, which evaluates rule bytecode on private input, output and recurrent arrays
+	std::string ruleInterpreterToCL(const std::vector<std::string> &functionNames);
+
+	// Rule with the same parameters as the one generated by ruleToCL (with weights), plus the bytecode.
+	// code[ruleIndex] is the start of the rule within the code. Only depends on the number of inputs, outputs and recurrents
+	std::string ruleWrapperToCL(ne::Phenotype &phenotype, const std::string &ruleName, int ruleIndex);
 }
\ No newline at end of file
@@ -8,7 +8,7 @@ void ThreadPool::WorkerThread::run(WorkerThread* pWorker) {
 	while (true) {
 		std::unique_lock<std::mutex> lock(pWorker->_mutex);
 
-		pWorker->_conditionVariable.wait(lock, [pWorker] { return pWorker->_proceed; });
+		pWorker->_conditionVariable.wait(lock, [pWorker] { return pWorker->_proceed.load(); });
 
 		pWorker->_proceed = false;
 
@@ -58,10 +58,13 @@ void ThreadPool::create(size_t numWorkers) {
 }
 
 void ThreadPool::destroy() {
-	//std::lock_guard<std::mutex> lock(_mutex);
+	// Not held while joining, workers that just finished an item still need it
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
 
-	_itemQueue.clear();
-	_availableThreadIndicies.clear();
+		_itemQueue.clear();
+		_availableThreadIndicies.clear();
+	}
 
 	for (size_t i = 0; i < _workers.size(); i++) {
 		{
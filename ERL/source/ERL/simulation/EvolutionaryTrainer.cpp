@@ -28,6 +28,9 @@ using namespace erl;
 
 EvolutionaryTrainer::EvolutionaryTrainer()
 : _runsPerExperiment(1),
+_batchBuildPrograms(false),
+_buildAheadIndividuals(0),
+_numEvaluationThreads(1),
 _numElites(3),
 _greedExponent(2.0f)
 {}
@@ -66,20 +69,99 @@ void EvolutionaryTrainer::evaluate(const Field2DEvolverSettings* pSettings,
 	for (size_t i = 0; i < _experiments.size(); i++)
 		fitnesses[i].resize(_evolutionaryAlgorithm.getPopulationSize());
 
+	if (_batchBuildPrograms) {
+		std::vector<std::string> sources;
+
+		for (size_t i = 0; i < _evolutionaryAlgorithm.getPopulationSize(); i++)
+		for (size_t j = 0; j < _experiments.size(); j++)
+			_experiments[j]->addNodeUpdateSources(_runsPerExperiment, *std::static_pointer_cast<Field2DGenes>(_evolutionaryAlgorithm.getPopulationMember(i)), _activationFunctionNames, logger, cs, sources);
+
+		cs.getProgramCache().buildBatch(cs.getContext(), cs.getDevice(), sources, "", logger);
+	}
+
+	// Grow the recurrent init bounds here, so evaluations only read the genes and evaluations of one individual can run at once
 	for (size_t i = 0; i < _evolutionaryAlgorithm.getPopulationSize(); i++)
-	for (size_t j = 0; j < _experiments.size(); j++) {
-		float experimentFitness = 0.0f;
+		std::static_pointer_cast<Field2DGenes>(_evolutionaryAlgorithm.getPopulationMember(i))->growRecurrentInitBounds(_minInitRec, _maxInitRec, generator);
+
+	// Every evaluation has its own generator, so the number of threads only changes scheduling
+	std::vector<unsigned long> seeds(_evolutionaryAlgorithm.getPopulationSize() * _experiments.size());
+
+	for (size_t i = 0; i < seeds.size(); i++)
+		seeds[i] = generator();
+
+	if (_numEvaluationThreads > 1) {
+		createWorkers(cs);
+
+		std::vector<std::shared_ptr<EvaluationItem>> items;
+
+		for (size_t i = 0; i < _evolutionaryAlgorithm.getPopulationSize(); i++)
+		for (size_t j = 0; j < _experiments.size(); j++) {
+			std::shared_ptr<EvaluationItem> item(new EvaluationItem());
+
+			item->_pTrainer = this;
+			item->_pSettings = pSettings;
+			item->_pLogger = &logger;
+			item->_individualIndex = i;
+			item->_experimentIndex = j;
+			item->_seed = seeds[i * _experiments.size() + j];
+			item->_fitness = 0.0f;
+
+			items.push_back(item);
+		}
 
-		logger << "Evaluating individual " << std::to_string(i + 1) << " of " << std::to_string(_evolutionaryAlgorithm.getPopulationSize()) << endl;
+		std::vector<std::future<void>> finished(items.size());
 
-		for (size_t k = 0; k < _runsPerExperiment; k++)
-			experimentFitness += _experiments[j]->evaluate(*std::static_pointer_cast<Field2DGenes>(_evolutionaryAlgorithm.getPopulationMember(i)), pSettings, _randomImage, _blurProgram, _blurKernelX, _blurKernelY, _activationFunctions, _activationFunctionNames, _minInitRec, _maxInitRec, logger, cs, generator);
+		for (size_t i = 0; i < items.size(); i++) {
+			finished[i] = items[i]->_finished.get_future();
 
-		experimentFitness /= _runsPerExperiment;
+			if (_workers.front()->_experiments[items[i]->_experimentIndex] != nullptr)
+				_evaluationThreadPool.addItem(items[i]);
+		}
 
-		logger << "Individual " << std::to_string(i + 1) << "'s total fitness for experiment " << std::to_string(j + 1) << ": " << std::to_string(experimentFitness) << endl;
+		// Experiments without copies are evaluated here in the meantime
+		for (size_t i = 0; i < items.size(); i++)
+			if (_workers.front()->_experiments[items[i]->_experimentIndex] == nullptr) {
+				std::mt19937 itemGenerator(items[i]->_seed);
 
-		fitnesses[j][i] = experimentFitness;
+				items[i]->_fitness = evaluateIndividual(items[i]->_individualIndex, items[i]->_experimentIndex, *_experiments[items[i]->_experimentIndex], pSettings,
+					_blurKernelX, _blurKernelY, cs, logger, itemGenerator);
+
+				items[i]->_finished.set_value();
+			}
+
+		for (size_t i = 0; i < items.size(); i++) {
+			finished[i].wait();
+
+			fitnesses[items[i]->_experimentIndex][items[i]->_individualIndex] = items[i]->_fitness;
+		}
+	}
+	else {
+		// Individuals whose programs are being built ahead
+		size_t numBuildsQueued = 0;
+
+		for (size_t i = 0; i < _evolutionaryAlgorithm.getPopulationSize(); i++)
+		for (size_t j = 0; j < _experiments.size(); j++) {
+			// Keep the programs of the next individuals building while this one is evaluated
+			if (!_batchBuildPrograms && _buildAheadIndividuals > 0) {
+				for (; numBuildsQueued < std::min(i + 1 + _buildAheadIndividuals, _evolutionaryAlgorithm.getPopulationSize()); numBuildsQueued++) {
+					std::vector<std::string> sources;
+
+					for (size_t k = 0; k < _experiments.size(); k++)
+						_experiments[k]->addNodeUpdateSources(_runsPerExperiment, *std::static_pointer_cast<Field2DGenes>(_evolutionaryAlgorithm.getPopulationMember(numBuildsQueued)), _activationFunctionNames, logger, cs, sources);
+
+					for (size_t k = 0; k < sources.size(); k++)
+						cs.getProgramCache().buildAhead(cs.getContext(), cs.getDevice(), sources[k], "");
+				}
+			}
+
+			std::mt19937 itemGenerator(seeds[i * _experiments.size() + j]);
+
+			fitnesses[j][i] = evaluateIndividual(i, j, *_experiments[j], pSettings, _blurKernelX, _blurKernelY, cs, logger, itemGenerator);
+		}
+
+		// Programs built ahead that no evaluation fetched would otherwise stay with the builds in progress
+		if (!_batchBuildPrograms && _buildAheadIndividuals > 0)
+			cs.getProgramCache().storeBuiltAhead(logger);
 	}
 
 	// Set fitnesses, scaled by experiment weight
@@ -93,6 +175,64 @@ void EvolutionaryTrainer::evaluate(const Field2DEvolverSettings* pSettings,
 	}
 }
 
+float EvolutionaryTrainer::evaluateIndividual(size_t individualIndex, size_t experimentIndex, Experiment &experiment, const Field2DEvolverSettings* pSettings,
+	const std::shared_ptr<cl::Kernel> &blurKernelX, const std::shared_ptr<cl::Kernel> &blurKernelY,
+	ComputeSystem &cs, Logger &logger, std::mt19937 &generator)
+{
+	// Whole lines, so lines of concurrent evaluations do not interleave
+	logger << "Evaluating individual " + std::to_string(individualIndex + 1) + " of " + std::to_string(_evolutionaryAlgorithm.getPopulationSize()) + endl;
+
+	float experimentFitness = experiment.evaluateRuns(_runsPerExperiment, *std::static_pointer_cast<Field2DGenes>(_evolutionaryAlgorithm.getPopulationMember(individualIndex)), pSettings, _randomImage, _blurProgram, blurKernelX, blurKernelY, _activationFunctions, _activationFunctionNames, _minInitRec, _maxInitRec, logger, cs, generator);
+
+	logger << "Individual " + std::to_string(individualIndex + 1) + "'s total fitness for experiment " + std::to_string(experimentIndex + 1) + ": " + std::to_string(experimentFitness) + endl;
+
+	return experimentFitness;
+}
+
+void EvolutionaryTrainer::createWorkers(ComputeSystem &cs) {
+	if (_workers.size() != _numEvaluationThreads) {
+		if (_evaluationThreadPool.getNumWorkers() > 0)
+			_evaluationThreadPool.destroy();
+
+		_workers.resize(_numEvaluationThreads);
+
+		for (size_t i = 0; i < _workers.size(); i++) {
+			if (_workers[i] != nullptr)
+				continue;
+
+			_workers[i].reset(new Worker());
+
+			_workers[i]->_cs.createShared(cs);
+
+			// Kernel arguments are per kernel object, so every thread needs its own
+			_workers[i]->_blurKernelX.reset(new cl::Kernel(*_blurProgram, _blurKernelX->getInfo<CL_KERNEL_FUNCTION_NAME>().c_str()));
+			_workers[i]->_blurKernelY.reset(new cl::Kernel(*_blurProgram, _blurKernelY->getInfo<CL_KERNEL_FUNCTION_NAME>().c_str()));
+		}
+
+		_evaluationThreadPool.create(_workers.size());
+	}
+
+	// Items index the copies like _experiments, so every worker needs one per experiment, including experiments added after it was created
+	for (size_t i = 0; i < _workers.size(); i++)
+		if (_workers[i]->_experiments.size() != _experiments.size()) {
+			_workers[i]->_experiments.clear();
+
+			for (size_t j = 0; j < _experiments.size(); j++)
+				_workers[i]->_experiments.push_back(_experiments[j]->clone());
+		}
+}
+
+void EvolutionaryTrainer::EvaluationItem::run(size_t threadIndex) {
+	Worker &worker = *_pTrainer->_workers[threadIndex];
+
+	std::mt19937 generator(_seed);
+
+	_fitness = _pTrainer->evaluateIndividual(_individualIndex, _experimentIndex, *worker._experiments[_experimentIndex], _pSettings,
+		worker._blurKernelX, worker._blurKernelY, worker._cs, *_pLogger, generator);
+
+	_finished.set_value();
+}
+
 void EvolutionaryTrainer::reproduce(const Field2DEvolverSettings* pSettings,
 	const std::vector<float> &functionChances, std::mt19937 &generator)
 {
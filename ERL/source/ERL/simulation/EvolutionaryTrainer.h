@@ -8,12 +8,52 @@ Evolutionary trainer
 
 #include <erl/field/Field2DEvolver.h>
 #include <erl/simulation/Experiment.h>
+#include <erl/platform/ThreadPool.h>
+
+#include <future>
 
 namespace erl {
 	class EvolutionaryTrainer {
 	private:
+		// State of an evaluation thread, so evaluations on different threads share nothing but the context and program cache.
+		// Experiments without copies run on the calling thread at the same time, on the cs passed to evaluate and the trainer's blur kernels.
+		// Its command queue is only used by that thread and OpenCL allows several threads to enqueue to one context, so it needs no worker of its own
+		struct Worker {
+			ComputeSystem _cs;
+
+			std::shared_ptr<cl::Kernel> _blurKernelX;
+			std::shared_ptr<cl::Kernel> _blurKernelY;
+
+			// Copies of the trainer's experiments, nullptr for experiments that are evaluated on the trainer's thread
+			std::vector<std::shared_ptr<Experiment>> _experiments;
+		};
+
+		// Evaluation of one individual in one experiment, run by the worker of the thread that picks it up
+		class EvaluationItem : public ThreadPool::WorkItem {
+		public:
+			EvolutionaryTrainer* _pTrainer;
+			const Field2DEvolverSettings* _pSettings;
+			Logger* _pLogger;
+
+			size_t _individualIndex;
+			size_t _experimentIndex;
+
+			// Seed of the evaluation's own generator, so its fitness does not depend on the thread it runs on
+			unsigned long _seed;
+
+			float _fitness;
+
+			std::promise<void> _finished;
+
+			void run(size_t threadIndex);
+		};
+
 		std::vector<std::shared_ptr<Experiment>> _experiments;
 
+		std::vector<std::unique_ptr<Worker>> _workers;
+
+		ThreadPool _evaluationThreadPool;
+
 		std::shared_ptr<cl::Image2D> _randomImage;
 		std::shared_ptr<cl::Program> _blurProgram;
 		std::shared_ptr<cl::Kernel> _blurKernelX;
@@ -23,11 +63,30 @@ namespace erl {
 		std::vector<std::string> _activationFunctionNames;
 		float _minInitRec, _maxInitRec;
 
+		// Average fitness of an individual over the runs of an experiment
+		float evaluateIndividual(size_t individualIndex, size_t experimentIndex, Experiment &experiment, const Field2DEvolverSettings* pSettings,
+			const std::shared_ptr<cl::Kernel> &blurKernelX, const std::shared_ptr<cl::Kernel> &blurKernelY,
+			ComputeSystem &cs, Logger &logger, std::mt19937 &generator);
+
+		void createWorkers(ComputeSystem &cs);
+
 	public:
 		Field2DEvolver _evolutionaryAlgorithm;
 
 		size_t _runsPerExperiment;
 
+		// Build the node update programs of a whole generation as one program before evaluating it, instead of one program per field
+		// Batched programs are only kept in memory, they are not saved to the program cache directory
+		bool _batchBuildPrograms;
+
+		// Number of following individuals whose node update programs are built on background threads while one is evaluated, 0 to build on field creation.
+		// Not used with _batchBuildPrograms, which builds them all before evaluating, or with _numEvaluationThreads > 1, where the evaluations build in parallel
+		size_t _buildAheadIndividuals;
+
+		// Threads evaluating individuals at once, each with its own command queue, blur kernels and experiment copies.
+		// 1 evaluates on the calling thread. Each evaluation gets a generator seeded from the trainer's, so fitnesses do not depend on scheduling
+		size_t _numEvaluationThreads;
+
 		size_t _numElites;
 		float _greedExponent;
 
@@ -59,12 +118,20 @@ namespace erl {
 		float getBestFitness() const;
 		float getAverageFitness() const;
 
+		// Changes the workers' experiment copies, so must not be called while another thread is in evaluate
 		void addExperiment(const std::shared_ptr<Experiment> &experiment) {
 			_experiments.push_back(experiment);
+
+			for (size_t i = 0; i < _workers.size(); i++)
+				_workers[i]->_experiments.push_back(experiment->clone());
 		}
 
+		// Must not be called while another thread is in evaluate, like addExperiment
 		void removeExperiment(size_t index) {
 			_experiments.erase(_experiments.begin() + index);
+
+			for (size_t i = 0; i < _workers.size(); i++)
+				_workers[i]->_experiments.erase(_workers[i]->_experiments.begin() + index);
 		}
 
 		size_t getNumExperiments() const {
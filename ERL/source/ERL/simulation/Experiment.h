@@ -10,13 +10,25 @@ Experiment
 #include <erl/platform/ComputeSystem.h>
 
 namespace erl {
+	// Arguments of the fields an experiment creates. Experiments pass the same values to create and getNodeUpdateSource,
+	// so the programs built ahead are the ones their evaluations fetch
+	struct FieldDimensions {
+		int _width, _height;
+		int _connectionRadius;
+		int _numInputs, _numOutputs;
+		int _inputRange, _outputRange;
+	};
+
 	class Experiment {
 	protected:
 		float _experimentWeight;
 
 	public:
+		// Create the experiment's fields with fp16 recurrent state
+		bool _halfPrecisionRecurrents;
+
 		Experiment()
-			: _experimentWeight(1.0f)
+			: _experimentWeight(1.0f), _halfPrecisionRecurrents(false)
 		{}
 
 		virtual float evaluate(Field2DGenes &fieldGenes, const Field2DEvolverSettings* pSettings,
@@ -29,6 +41,37 @@ namespace erl {
 			float minInitRec, float maxInitRec, Logger &logger,
 			ComputeSystem &cs, std::mt19937 &generator) = 0;
 
+		// Average fitness over independent runs. Experiments that can step all runs at once in a Field2DBatch override this
+		virtual float evaluateRuns(size_t numRuns, Field2DGenes &fieldGenes, const Field2DEvolverSettings* pSettings,
+			const std::shared_ptr<cl::Image2D> &randomImage,
+			const std::shared_ptr<cl::Program> &blurProgram,
+			const std::shared_ptr<cl::Kernel> &blurKernelX,
+			const std::shared_ptr<cl::Kernel> &blurKernelY,
+			const std::vector<std::function<float(float)>> &activationFunctions,
+			const std::vector<std::string> &activationFunctionNames,
+			float minInitRec, float maxInitRec, Logger &logger,
+			ComputeSystem &cs, std::mt19937 &generator)
+		{
+			float fitness = 0.0f;
+
+			for (size_t i = 0; i < numRuns; i++)
+				fitness += evaluate(fieldGenes, pSettings, randomImage, blurProgram, blurKernelX, blurKernelY, activationFunctions, activationFunctionNames, minInitRec, maxInitRec, logger, cs, generator);
+
+			return fitness / numRuns;
+		}
+
+		// Add the node update sources of the fields evaluateRuns would create for these genes and runs, so a trainer can build them ahead in one batch.
+		// Experiments that do not know their fields in advance add nothing, their fields build on creation
+		virtual void addNodeUpdateSources(size_t numRuns, Field2DGenes &fieldGenes, const std::vector<std::string> &activationFunctionNames, Logger &logger,
+			ComputeSystem &cs, std::vector<std::string> &sources)
+		{}
+
+		// Copy of the experiment for another thread, so a trainer can evaluate several genotypes at once.
+		// Experiments that can not run concurrently return nullptr, and are evaluated on the trainer's thread
+		virtual std::shared_ptr<Experiment> clone() const {
+			return nullptr;
+		}
+
 		float getExperimentWeight() const {
 			return _experimentWeight;
 		}
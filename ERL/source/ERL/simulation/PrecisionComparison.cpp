@@ -0,0 +1,73 @@
+#include <erl/simulation/PrecisionComparison.h>
+
+#include <algorithm>
+#include <cmath>
+
+erl::PrecisionDivergence erl::compareRecurrentPrecision(Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+	int inputRange, int outputRange,
+	const std::shared_ptr<cl::Image2D> &randomImage,
+	const std::shared_ptr<cl::Program> &gasBlurProgram,
+	const std::shared_ptr<cl::Kernel> &gasBlurKernelX,
+	const std::shared_ptr<cl::Kernel> &gasBlurKernelY,
+	const std::vector<std::function<float(float)>> &activationFunctions, const std::vector<std::string> &activationFunctionNames,
+	float minRecInit, float maxRecInit, int numSteps, int substeps, std::mt19937 &generator,
+	Logger &logger)
+{
+	// Both fields draw from their own copy of the same generator, so initial state and random seeds match.
+	// Creating a field may extend the init bounds of the genes, so each field gets its own copy of them as well
+	std::mt19937 fullGenerator = generator;
+	std::mt19937 halfGenerator = generator;
+
+	Field2DGenes fullGenes = genes;
+	Field2DGenes halfGenes = genes;
+
+	Field2DCL fullField;
+	Field2DCL halfField;
+
+	halfField._halfPrecisionRecurrents = true;
+
+	fullField.create(fullGenes, cs, width, height, connectionRadius, numInputs, numOutputs, inputRange, outputRange, randomImage, gasBlurProgram, gasBlurKernelX, gasBlurKernelY, activationFunctions, activationFunctionNames, minRecInit, maxRecInit, fullGenerator, logger);
+	halfField.create(halfGenes, cs, width, height, connectionRadius, numInputs, numOutputs, inputRange, outputRange, randomImage, gasBlurProgram, gasBlurKernelX, gasBlurKernelY, activationFunctions, activationFunctionNames, minRecInit, maxRecInit, halfGenerator, logger);
+
+	std::uniform_real_distribution<float> inputDist(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> rewardDist(0.0f, 1.0f);
+
+	PrecisionDivergence divergence;
+
+	float divergenceSum = 0.0f;
+
+	for (int s = 0; s < numSteps; s++) {
+		for (int i = 0; i < numInputs; i++) {
+			float input = inputDist(generator);
+
+			fullField.setInput(i, input);
+			halfField.setInput(i, input);
+		}
+
+		float reward = rewardDist(generator);
+
+		fullField.update(reward, cs, activationFunctions, substeps, fullGenerator);
+		halfField.update(reward, cs, activationFunctions, substeps, halfGenerator);
+
+		float stepMaxDivergence = 0.0f;
+
+		for (int i = 0; i < numOutputs; i++) {
+			float outputDivergence = std::abs(fullField.getOutput(i) - halfField.getOutput(i));
+
+			stepMaxDivergence = std::max(stepMaxDivergence, outputDivergence);
+
+			divergenceSum += outputDivergence;
+		}
+
+		divergence._maxDivergence = std::max(divergence._maxDivergence, stepMaxDivergence);
+		divergence._finalMaxDivergence = stepMaxDivergence;
+	}
+
+	if (numSteps > 0 && numOutputs > 0)
+		divergence._meanDivergence = divergenceSum / (numSteps * numOutputs);
+
+	logger << "fp16 recurrent divergence over " << std::to_string(numSteps) << " steps - max: " << std::to_string(divergence._maxDivergence)
+		<< " mean: " << std::to_string(divergence._meanDivergence) << " final: " << std::to_string(divergence._finalMaxDivergence) << erl::endl;
+
+	return divergence;
+}
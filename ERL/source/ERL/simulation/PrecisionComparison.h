@@ -0,0 +1,34 @@
+/*
+ERL
+
+Precision Comparison
+*/
+
+#pragma once
+
+#include <erl/field/Field2DCL.h>
+
+namespace erl {
+	struct PrecisionDivergence {
+		float _maxDivergence;
+		float _meanDivergence;
+
+		// Divergence of the outputs after the last step
+		float _finalMaxDivergence;
+
+		PrecisionDivergence()
+			: _maxDivergence(0.0f), _meanDivergence(0.0f), _finalMaxDivergence(0.0f)
+		{}
+	};
+
+	// Runs the same genes with fp32 and fp16 recurrent state on identical random inputs, rewards and seeds, and measures how far the outputs drift apart
+	PrecisionDivergence compareRecurrentPrecision(Field2DGenes &genes, ComputeSystem &cs, int width, int height, int connectionRadius, int numInputs, int numOutputs,
+		int inputRange, int outputRange,
+		const std::shared_ptr<cl::Image2D> &randomImage,
+		const std::shared_ptr<cl::Program> &gasBlurProgram,
+		const std::shared_ptr<cl::Kernel> &gasBlurKernelX,
+		const std::shared_ptr<cl::Kernel> &gasBlurKernelY,
+		const std::vector<std::function<float(float)>> &activationFunctions, const std::vector<std::string> &activationFunctionNames,
+		float minRecInit, float maxRecInit, int numSteps, int substeps, std::mt19937 &generator,
+		Logger &logger);
+}
@@ -24,16 +24,14 @@ bool FieldVisualizer::create(ComputeSystem &cs, const std::string &adapterFileNa
 		programStr += line + "\n";
 	}
 
-	_adapterProgram = cl::Program(cs.getContext(), programStr);
+	_adapterProgram = cs.getProgramCache().get(cs.getContext(), cs.getDevice(), programStr, "", logger);
 
-	if (_adapterProgram.build({ cs.getDevice() }) != CL_SUCCESS) {
-		logger << "Error building: " << _adapterProgram.getBuildInfo<CL_PROGRAM_BUILD_LOG>(cs.getDevice()) << erl::endl;
+	if (_adapterProgram == nullptr)
 		abort();
-	}
 
 	//_adapterKernelFunctor = cl::make_kernel<cl::Buffer&, cl::Image2D&, int, int, int>(_adapterProgram, "adapt", &err);
 
-	_adapterKernel = cl::Kernel(_adapterProgram, "adapt", &err);
+	_adapterKernel = cl::Kernel(*_adapterProgram, "adapt", &err);
 
 	if (err != CL_SUCCESS) {
 		logger << "Could not create kernel functor!" << endl;
@@ -57,7 +55,7 @@ void FieldVisualizer::update(ComputeSystem &cs, Field2DCL &field) {
 	_adapterKernel.setArg(0, field.getBuffer());
 	_adapterKernel.setArg(1, _adaptedImage);
 	_adapterKernel.setArg(2, field.getWidth());
-	_adapterKernel.setArg(3, field.getNodeAndConnectionsSize());
+	_adapterKernel.setArg(3, field.getNodeStride());
 	_adapterKernel.setArg(4, field.getNodeOutputSize());
 
 	cs.getQueue().enqueueNDRangeKernel(_adapterKernel, cl::NullRange, cl::NDRange(field.getWidth(), field.getHeight()));
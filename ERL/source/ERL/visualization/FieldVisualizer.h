@@ -16,7 +16,7 @@ namespace erl {
 	class FieldVisualizer {
 	private:
 		// Visualization adapter (field to texture)
-		cl::Program _adapterProgram;
+		std::shared_ptr<cl::Program> _adapterProgram;
 		cl::Kernel _adapterKernel;
 		//std::function<cl::Event(const cl::EnqueueArgs&, cl::Buffer&, cl::Image2D&, int, int, int)> _adapterKernelFunctor;
 		cl::Image2D _adaptedImage;
@@ -9,6 +9,7 @@ Main
 #include <erl/platform/Field2DGenesToCL.h>
 #include <erl/visualization/FieldVisualizer.h>
 #include <erl/simulation/EvolutionaryTrainer.h>
+#include <erl/simulation/PrecisionComparison.h>
 #include <erl/field/Field2DEvolverSettings.h>
 
 #include <erl/experiments/LuaExperiment.h>
@@ -22,6 +23,7 @@ Main
 #include <time.h>
 #include <iostream>
 #include <fstream>
+#include <thread>
 
 int main() {
 	std::cout << "Welcome to ERL. Version " << ERL_VERSION << std::endl;
@@ -34,6 +36,9 @@ int main() {
 
 	cs.create(erl::ComputeSystem::_gpu, logger);
 
+	// Keep built programs across runs
+	cs.getProgramCache()._directory = "programCache";
+
 	std::mt19937 generator(time(nullptr));
 
 	std::vector<float> functionChances(3);
@@ -87,12 +92,10 @@ int main() {
 		blurSource += line + "\n";
 	}
 
-	std::shared_ptr<cl::Program> blurProgram(new cl::Program(cs.getContext(), blurSource));
+	std::shared_ptr<cl::Program> blurProgram = cs.getProgramCache().get(cs.getContext(), cs.getDevice(), blurSource, "", logger);
 
-	if (blurProgram->build({ cs.getDevice() }) != CL_SUCCESS) {
-		logger << "Error building: " << blurProgram->getBuildInfo<CL_PROGRAM_BUILD_LOG>(cs.getDevice()) << erl::endl;
+	if (blurProgram == nullptr)
 		abort();
-	}
 
 	std::shared_ptr<cl::Kernel> blurKernelX(new cl::Kernel(*blurProgram, "blurX"));
 	std::shared_ptr<cl::Kernel> blurKernelY(new cl::Kernel(*blurProgram, "blurY"));
@@ -100,7 +103,8 @@ int main() {
 	std::cout << "Select option:" << std::endl;
 	std::cout << "(1) - Train ERL" << std::endl;
 	std::cout << "(2) - Visualize ERL (Pole Balancing)" << std::endl;
-	std::cout << "(3) - Exit" << std::endl;
+	std::cout << "(3) - Compare fp32 and fp16 recurrent state (C++ Pole Balancing, not polebalancing.lua)" << std::endl;
+	std::cout << "(4) - Exit" << std::endl;
 	std::cout << ">";
 
 	int choice = -1;
@@ -109,7 +113,7 @@ int main() {
 		try {
 			std::cin >> choice;
 
-			if (choice < 1 || choice > 3)
+			if (choice < 1 || choice > 4)
 				throw std::exception();
 		}
 		catch (std::exception) {
@@ -227,11 +231,16 @@ int main() {
 			  trainer.create(populationSize, settings.get(), functionChances, randomImage, blurProgram, blurKernelX, blurKernelY, functions, functionNames, -1.0f, 1.0f, generator);
 
 			  trainer._runsPerExperiment = runsPerExperiment;
+			  // Batching pays the build overhead once per generation, but its programs are only kept in memory.
+			  // Building separately saves every program to the program cache directory, so later runs load them instead, and lets the evaluation threads build in parallel
+			  trainer._batchBuildPrograms = false;
+			  trainer._numEvaluationThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
 
 			  for (size_t i = 0; i < experimentFileNames.size(); i++) {
 				  std::shared_ptr<LuaExperiment> experiment(new LuaExperiment());
 
-				  experiment->create(experimentFileNames[i]);
+				  // One VM per evaluation thread
+				  experiment->create(experimentFileNames[i], logger, trainer._numEvaluationThreads);
 
 				  trainer.addExperiment(experiment);
 			  }
@@ -270,6 +279,8 @@ int main() {
 
 				  trainer.evaluate(settings.get(), functionChances, cs, logger, generator);
 
+				  logger << "Program cache: " << std::to_string(cs.getProgramCache().getNumHits()) << " hits, " << std::to_string(cs.getProgramCache().getNumMisses() - cs.getProgramCache().getNumDiskHits()) << " builds, " << std::to_string(cs.getProgramCache().getNumDiskHits()) << " loaded from disk." << erl::endl;
+
 				  float bestFitness = trainer.getBestFitness();
 				  float averageFitness = trainer.getAverageFitness();
 
@@ -590,6 +601,63 @@ int main() {
 		break;
 
 	case 3:
+	{
+			  // ------------------------------------------- Precision -------------------------------------------
+
+			  std::cout << "Comparing fp32 and fp16 recurrent state on \"erlOutput.txt\"." << std::endl;
+
+			  std::shared_ptr<erl::Field2DEvolverSettings> settings(new erl::Field2DEvolverSettings());
+
+			  std::ifstream fromSettings("settings.txt");
+
+			  if (!fromSettings.is_open()) {
+				  std::cout << "Could not find \"settings.txt\"! Make sure the file exists. Exiting..." << std::endl;
+
+				  return 0;
+			  }
+
+			  settings->readFromStream(fromSettings);
+
+			  fromSettings.close();
+
+			  erl::Field2DGenes genes;
+
+			  std::ifstream fromFile("erlOutput.txt");
+
+			  if (!fromFile.is_open()) {
+				  std::cout << "Could not find \"erlOutput.txt\"! Make sure the file exists. Exiting..." << std::endl;
+
+				  return 0;
+			  }
+
+			  genes.readFromStream(fromFile);
+
+			  fromFile.close();
+
+			  ExperimentPoleBalancing fullEx;
+			  ExperimentPoleBalancing halfEx;
+
+			  halfEx._halfPrecisionRecurrents = true;
+
+			  // The divergence is written to the log
+			  fullEx.compareRecurrentPrecision(genes, randomImage, blurProgram, blurKernelX, blurKernelY, functions, functionNames, -1.0f, 1.0f, logger, cs, generator);
+
+			  // Same genes and seed for both runs, so any fitness difference comes from the storage precision
+			  std::mt19937 fullGenerator = generator;
+			  std::mt19937 halfGenerator = generator;
+
+			  erl::Field2DGenes fullGenes = genes;
+			  erl::Field2DGenes halfGenes = genes;
+
+			  float fullRes = fullEx.evaluate(fullGenes, settings.get(), randomImage, blurProgram, blurKernelX, blurKernelY, functions, functionNames, -1.0f, 1.0f, logger, cs, fullGenerator);
+			  float halfRes = halfEx.evaluate(halfGenes, settings.get(), randomImage, blurProgram, blurKernelX, blurKernelY, functions, functionNames, -1.0f, 1.0f, logger, cs, halfGenerator);
+
+			  std::cout << "Experiment result fp32: " << fullRes << " fp16: " << halfRes << std::endl;
+	}
+
+		break;
+
+	case 4:
 
 		break;
 